@@ -0,0 +1,650 @@
+// Offline benchmark of the minifiers on synthetic documents
+//
+// The documents are generated from a seed, so that the same seed gives the same documents on every
+// machine without downloading anything. Every format and size class is measured in a child process,
+// whose peak resident set size is reported next to the throughput. With --compare, a benchmark built
+// from another revision of cminify.c is measured in the same session, alternating with this build.
+
+#include <math.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define CMINIFY_NO_MAIN
+#include "cminify.c"
+
+// Minimum number of timed runs and minimum total time of the timed runs of one measurement
+#define BENCH_MIN_RUNS 5
+#define BENCH_MIN_SECONDS 0.5
+#define BENCH_MAX_RUNS 1000
+
+// Rounds of --compare, each measuring both builds in separate processes. The throughput of a process
+// can differ from the next one by much more than the deviation of its runs, so the noise is estimated
+// from the rounds. A throughput drop is only a regression if it exceeds the threshold plus this many
+// median absolute deviations of the ratios of the rounds.
+#define BENCH_COMPARE_ROUNDS 5
+#define BENCH_NOISE_MADS 3
+
+struct Random
+{
+    uint64_t state;
+};
+
+// xorshift64*, which is good enough for generating documents and the same on every platform
+static uint64_t random_next(struct Random *random)
+{
+    random->state ^= random->state >> 12;
+    random->state ^= random->state << 25;
+    random->state ^= random->state >> 27;
+    return random->state * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned random_below(struct Random *random, unsigned bound)
+{
+    return (random_next(random) >> 32) % bound;
+}
+
+static const char *random_pick(struct Random *random, const char *const *words, size_t count)
+{
+    return words[random_below(random, count)];
+}
+
+#define RANDOM_PICK(random, words) random_pick(random, words, sizeof words / sizeof *words)
+
+static const char *const identifiers[] = {
+    "value", "index", "result", "element", "options", "callback", "count", "node", "items", "config",
+    "width", "height", "offset", "buffer", "state", "context", "handler", "target", "source", "data",
+};
+
+static const char *const words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do",
+    "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua", "enim",
+};
+
+static const char *const colors[] = {
+    "#ff0000", "#FFFFFF", "#336699", "rgb(0, 0, 0)", "red", "transparent", "#00000080", "currentColor",
+};
+
+struct Buffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static void buffer_printf(struct Buffer *buffer, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+    if (buffer->length + length + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity == 0 ? 65536 : buffer->capacity;
+        while (buffer->length + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            perror("bench");
+            exit(EXIT_FAILURE);
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    va_start(arguments, format);
+    vsnprintf(&buffer->data[buffer->length], length + 1, format, arguments);
+    va_end(arguments);
+    buffer->length += length;
+}
+
+static void generate_sentence(struct Random *random, struct Buffer *buffer)
+{
+    unsigned count = 3 + random_below(random, 10);
+    for (unsigned k = 0; k < count; ++k) {
+        buffer_printf(buffer, k == 0 ? "%s" : " %s", RANDOM_PICK(random, words));
+    }
+}
+
+// Nested JSON with pretty-printing, as written by most serializers
+static void generate_json_value(struct Random *random, struct Buffer *buffer, unsigned depth)
+{
+    unsigned kind = depth >= 5 ? 2 + random_below(random, 4) : random_below(random, 6);
+    switch (kind) {
+    case 0:
+    case 1: {
+        bool is_object = kind == 0;
+        unsigned count = 1 + random_below(random, 6);
+        buffer_printf(buffer, is_object ? "{\n" : "[\n");
+        for (unsigned k = 0; k < count; ++k) {
+            buffer_printf(buffer, "%*s", 2 * (depth + 1), "");
+            if (is_object) {
+                buffer_printf(buffer, "\"%s_%u\": ", RANDOM_PICK(random, identifiers), k);
+            }
+            generate_json_value(random, buffer, depth + 1);
+            buffer_printf(buffer, k + 1 < count ? ",\n" : "\n");
+        }
+        buffer_printf(buffer, "%*s%c", 2 * depth, "", is_object ? '}' : ']');
+        break;
+    }
+    case 2:
+        buffer_printf(buffer, "\"");
+        generate_sentence(random, buffer);
+        buffer_printf(buffer, "\"");
+        break;
+    case 3:
+        buffer_printf(buffer, "%u.%02u", random_below(random, 100000), random_below(random, 100));
+        break;
+    case 4:
+        buffer_printf(buffer, "%d", (int) random_below(random, 2000000) - 1000000);
+        break;
+    default:
+        buffer_printf(buffer, random_below(random, 3) == 0 ? "null" : random_below(random, 2) ? "true" : "false");
+    }
+}
+
+static void generate_json(struct Random *random, struct Buffer *buffer, size_t size)
+{
+    buffer_printf(buffer, "[\n");
+    while (buffer->length < size) {
+        buffer_printf(buffer, "  ");
+        generate_json_value(random, buffer, 1);
+        buffer_printf(buffer, ",\n");
+    }
+    buffer_printf(buffer, "  null\n]\n");
+}
+
+// Utility-class stylesheets with comments and media queries
+static void generate_css(struct Random *random, struct Buffer *buffer, size_t size)
+{
+    static const char *const properties[] = {
+        "margin", "padding", "margin-top", "padding-left", "width", "max-width", "font-size", "line-height",
+    };
+    static const char *const breakpoints[] = {"sm", "md", "lg", "xl"};
+
+    buffer_printf(buffer, "/* Generated utility classes */\n");
+    while (buffer->length < size) {
+        unsigned kind = random_below(random, 8);
+        if (kind == 0) {
+            buffer_printf(buffer, "\n/* ");
+            generate_sentence(random, buffer);
+            buffer_printf(buffer, " */\n");
+        }
+        else if (kind == 1) {
+            const char *breakpoint = RANDOM_PICK(random, breakpoints);
+            buffer_printf(buffer, "@media (min-width: %upx) {\n  .%s\\:p-%u {\n    padding: %u.%urem;\n  }\n}\n",
+                640 + 128 * random_below(random, 8), breakpoint, random_below(random, 16), random_below(random, 4),
+                random_below(random, 10));
+        }
+        else if (kind == 2) {
+            const char *color = RANDOM_PICK(random, colors);
+            buffer_printf(buffer, ".text-%s-%u, .hover\\:text-%u:hover {\n  color: %s;\n  border-color: %s;\n}\n",
+                RANDOM_PICK(random, words), 100 * (1 + random_below(random, 9)), random_below(random, 1000),
+                color, color);
+        }
+        else {
+            const char *property = RANDOM_PICK(random, properties);
+            buffer_printf(buffer, ".%.1s-%u {\n  %s: %u.%upx;\n  %s: 0px 0.50em;\n}\n", property,
+                random_below(random, 100), property, random_below(random, 64), random_below(random, 10),
+                RANDOM_PICK(random, properties));
+        }
+    }
+}
+
+static void generate_js_function(struct Random *random, struct Buffer *buffer, unsigned indent)
+{
+    const char *name = RANDOM_PICK(random, identifiers);
+    const char *argument = RANDOM_PICK(random, identifiers);
+    buffer_printf(buffer, "%*s/**\n%*s * ", indent, "", indent, "");
+    generate_sentence(random, buffer);
+    buffer_printf(buffer, "\n%*s * @param {Object} %s\n%*s */\n", indent, "", argument, indent, "");
+    buffer_printf(buffer, "%*sfunction %s%u ( %s , callback ) {\n", indent, "", name, random_below(random, 10000),
+        argument);
+    unsigned count = 2 + random_below(random, 6);
+    for (unsigned k = 0; k < count; ++k) {
+        const char *variable = RANDOM_PICK(random, identifiers);
+        switch (random_below(random, 5)) {
+        case 0:
+            buffer_printf(buffer, "%*s    // ", indent, "");
+            generate_sentence(random, buffer);
+            buffer_printf(buffer, "\n");
+            break;
+        case 1:
+            buffer_printf(buffer, "%*s    if ( %s . %s === undefined ) {\n%*s        return false ;\n%*s    }\n",
+                indent, "", argument, variable, indent, "", indent, "");
+            break;
+        case 2:
+            buffer_printf(buffer, "%*s    for ( let i = 0 ; i < %s . length ; i ++ ) {\n"
+                "%*s        callback ( %s [ i ] , \"%s\" ) ;\n%*s    }\n",
+                indent, "", argument, indent, "", argument, RANDOM_PICK(random, words), indent, "");
+            break;
+        case 3:
+            buffer_printf(buffer, "%*s    const %s = ( a , b ) => a * %u + b / 2 ; /* %s */\n", indent, "", variable,
+                random_below(random, 1000), RANDOM_PICK(random, words));
+            break;
+        default:
+            buffer_printf(buffer, "%*s    var %s = '%s' + %s . toString ( ) ;\n", indent, "", variable,
+                RANDOM_PICK(random, words), argument);
+        }
+    }
+    buffer_printf(buffer, "%*s    return true ;\n%*s}\n\n", indent, "", indent, "");
+}
+
+// Scripts with documentation comments, line comments and generous whitespace
+static void generate_js(struct Random *random, struct Buffer *buffer, size_t size)
+{
+    buffer_printf(buffer, "'use strict' ;\n\n");
+    while (buffer->length < size) {
+        generate_js_function(random, buffer, 0);
+    }
+}
+
+// SVG drawings with inline styles
+static void generate_svg(struct Random *random, struct Buffer *buffer, size_t size)
+{
+    buffer_printf(buffer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 1000 1000\">\n"
+        "  <!-- Generated drawing -->\n  <style>\n    .shape { stroke : #000000 ; }\n  </style>\n");
+    while (buffer->length < size) {
+        buffer_printf(buffer, "  <g transform=\"translate(%u, %u)\" style=\" fill : %s ; opacity : 0.%u0 \">\n",
+            random_below(random, 1000), random_below(random, 1000), RANDOM_PICK(random, colors),
+            random_below(random, 10));
+        unsigned count = 1 + random_below(random, 5);
+        for (unsigned k = 0; k < count; ++k) {
+            buffer_printf(buffer, "    <path class=\"shape\" d=\"M %u %u L %u %u Q %u %u %u %u Z\" "
+                "style=\"stroke-width : %u.0px\" />\n", random_below(random, 100), random_below(random, 100),
+                random_below(random, 100), random_below(random, 100), random_below(random, 100),
+                random_below(random, 100), random_below(random, 100), random_below(random, 100),
+                1 + random_below(random, 4));
+        }
+        buffer_printf(buffer, "    <text x=\"0\" y=\"0\">  ");
+        generate_sentence(random, buffer);
+        buffer_printf(buffer, "  </text>\n  </g>\n");
+    }
+    buffer_printf(buffer, "</svg>\n");
+}
+
+// Pages with indented markup, comments and inline scripts and styles
+static void generate_html(struct Random *random, struct Buffer *buffer, size_t size)
+{
+    buffer_printf(buffer, "<!DOCTYPE html>\n<html lang=\"en\">\n  <head>\n    <title>Benchmark</title>\n"
+        "    <style>\n      body { margin : 0px ; color : #333333 ; }\n    </style>\n  </head>\n  <body>\n");
+    while (buffer->length < size) {
+        unsigned kind = random_below(random, 6);
+        if (kind == 0) {
+            buffer_printf(buffer, "    <script>\n");
+            generate_js_function(random, buffer, 6);
+            buffer_printf(buffer, "    </script>\n");
+        }
+        else if (kind == 1) {
+            buffer_printf(buffer, "    <!-- ");
+            generate_sentence(random, buffer);
+            buffer_printf(buffer, " -->\n");
+        }
+        else {
+            buffer_printf(buffer, "    <div class=\"card card-%u\" style=\" color : %s ; \">\n      <h2>  ",
+                random_below(random, 100), RANDOM_PICK(random, colors));
+            generate_sentence(random, buffer);
+            buffer_printf(buffer, "  </h2>\n      <p>\n        ");
+            generate_sentence(random, buffer);
+            buffer_printf(buffer, "\n        <a href=\"/%s/%u\" onclick=\" track ( %u ) ; \">  %s  </a>\n      </p>\n"
+                "    </div>\n", RANDOM_PICK(random, words), random_below(random, 1000), random_below(random, 1000),
+                RANDOM_PICK(random, words));
+        }
+    }
+    buffer_printf(buffer, "  </body>\n</html>\n");
+}
+
+static const struct BenchFormat
+{
+    const char *name;
+    enum Format format;
+    void (*generate)(struct Random *, struct Buffer *, size_t);
+} bench_formats[] = {
+    {"json", FORMAT_JSON, generate_json},
+    {"css", FORMAT_CSS, generate_css},
+    {"js", FORMAT_JS, generate_js},
+    {"xml", FORMAT_XML, generate_svg},
+    {"html", FORMAT_HTML, generate_html},
+};
+
+static const struct BenchSize
+{
+    const char *name;
+    size_t size;
+} bench_sizes[] = {
+    {"small", 16 << 10},
+    {"medium", 1 << 20},
+    {"large", 16 << 20},
+};
+
+struct BenchResult
+{
+    size_t input_length;
+    size_t output_length;
+    size_t runs;
+    double median_seconds;
+    double mad_seconds;
+    long peak_rss_kib;
+    bool success;
+};
+
+// Runs in the child process, so that its peak memory usage is not mixed with other measurements
+static struct BenchResult bench_run(const struct BenchFormat *format, const struct BenchSize *size,
+    uint64_t seed, const struct MinifyOptions *options)
+{
+    struct BenchResult result = {.success = false};
+    struct Random random = {.state = seed == 0 ? 1 : seed};
+    struct Buffer input = {NULL, 0, 0};
+    format->generate(&random, &input, size->size);
+    result.input_length = input.length;
+
+    // The first run warms up the caches and the allocator and checks that the document is valid
+    struct Minification m = minify_format(input.data, format->format, options);
+    if (m.result == NULL) {
+        struct LineColumn line_column = position_to_line_column(input.data, m.error_position);
+        fprintf(stderr, "%s %s: ", format->name, size->name);
+        fprintf(stderr, m.error, line_column.line, line_column.column);
+        fputc('\n', stderr);
+        free(input.data);
+        return result;
+    }
+    result.output_length = strlen(m.result);
+    free(m.result);
+
+    static double seconds[BENCH_MAX_RUNS];
+    double total_seconds = 0;
+    while (result.runs < BENCH_MAX_RUNS && (result.runs < BENCH_MIN_RUNS || total_seconds < BENCH_MIN_SECONDS)) {
+        double start = now_seconds();
+        m = minify_format(input.data, format->format, options);
+        seconds[result.runs] = now_seconds() - start;
+        free(m.result);
+        total_seconds += seconds[result.runs++];
+    }
+    result.median_seconds = median(seconds, result.runs);
+    for (size_t k = 0; k < result.runs; ++k) {
+        seconds[k] = fabs(seconds[k] - result.median_seconds);
+    }
+    result.mad_seconds = median(seconds, result.runs);
+    result.success = true;
+    free(input.data);
+    return result;
+}
+
+static bool bench_measure(const struct BenchFormat *format, const struct BenchSize *size, uint64_t seed,
+    const struct MinifyOptions *options, const char *program, struct BenchResult *result)
+{
+    // Measures in a child process of this build or, if `program` is not NULL, of that benchmark, which
+    // writes its result to the standard output
+
+    char seed_string[24], threads_string[16];
+    snprintf(seed_string, sizeof seed_string, "%llu", (unsigned long long) seed);
+    snprintf(threads_string, sizeof threads_string, "%u", options->threads);
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(pipe_fds[0]);
+        if (program != NULL) {
+            dup2(pipe_fds[1], STDOUT_FILENO);
+            execl(program, program, "--child", "--format", format->name, "--size", size->name, "--seed",
+                seed_string, "--threads", threads_string, (char *) NULL);
+            perror(program);
+            _exit(EXIT_FAILURE);
+        }
+        struct BenchResult child_result = bench_run(format, size, seed, options);
+        bool written = write(pipe_fds[1], &child_result, sizeof child_result) == sizeof child_result;
+        _exit(written && child_result.success ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(pipe_fds[1]);
+    bool success = read(pipe_fds[0], result, sizeof *result) == sizeof *result;
+    close(pipe_fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        perror("wait4");
+        return false;
+    }
+    if (!success || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS || !result->success) {
+        fprintf(stderr, "Benchmark of %s %s failed\n", format->name, size->name);
+        return false;
+    }
+
+    // ru_maxrss is in kilobytes on Linux and the BSDs but in bytes on macOS
+#ifdef __APPLE__
+    result->peak_rss_kib = usage.ru_maxrss / 1024;
+#else
+    result->peak_rss_kib = usage.ru_maxrss;
+#endif
+    return true;
+}
+
+// Writes the generated document to `<directory>/<size>.<format>`, for example as training input for
+// profile-guided optimization
+static bool write_document(const struct BenchFormat *format, const struct BenchSize *size, uint64_t seed,
+    const char *directory)
+{
+    struct Random random = {.state = seed == 0 ? 1 : seed};
+    struct Buffer document = {NULL, 0, 0};
+    format->generate(&random, &document, size->size);
+    size_t filename_size = strlen(directory) + strlen(size->name) + strlen(format->name) + 3;
+    char *filename = malloc(filename_size);
+    if (filename == NULL) {
+        free(document.data);
+        perror(directory);
+        return false;
+    }
+    snprintf(filename, filename_size, "%s/%s.%s", directory, size->name, format->name);
+    FILE *fp = fopen(filename, "w");
+    bool success = fp != NULL && fwrite(document.data, 1, document.length, fp) == document.length;
+    if (fp != NULL && fclose(fp) != 0) {
+        success = false;
+    }
+    if (!success) {
+        perror(filename);
+    }
+    free(filename);
+    free(document.data);
+    return success;
+}
+
+// Measures both builds in alternating order in every round and compares the median ratio of their
+// times, so that a slower or faster period of the machine affects both of them
+static bool bench_compare(const struct BenchFormat *format, const struct BenchSize *size, uint64_t seed,
+    const struct MinifyOptions *options, const char *baseline_program, double threshold_percent,
+    bool *regression)
+{
+    double seconds[BENCH_COMPARE_ROUNDS], baseline_seconds[BENCH_COMPARE_ROUNDS];
+    double ratios[BENCH_COMPARE_ROUNDS];
+    struct BenchResult result, baseline_result;
+    for (size_t round = 0; round < BENCH_COMPARE_ROUNDS; ++round) {
+        bool baseline_first = round % 2;
+        if (baseline_first && !bench_measure(format, size, seed, options, baseline_program, &baseline_result) ||
+            !bench_measure(format, size, seed, options, NULL, &result) ||
+            !baseline_first && !bench_measure(format, size, seed, options, baseline_program, &baseline_result))
+        {
+            return false;
+        }
+        seconds[round] = result.median_seconds;
+        baseline_seconds[round] = baseline_result.median_seconds;
+        ratios[round] = baseline_result.median_seconds / result.median_seconds;
+    }
+    double ratio = median(ratios, BENCH_COMPARE_ROUNDS);
+    for (size_t round = 0; round < BENCH_COMPARE_ROUNDS; ++round) {
+        ratios[round] = fabs(ratios[round] - ratio);
+    }
+    double change_percent = 100 * (ratio - 1);
+    double noise_percent = 100 * median(ratios, BENCH_COMPARE_ROUNDS);
+    *regression = -change_percent > threshold_percent + BENCH_NOISE_MADS * noise_percent;
+    printf("%-6s %-7s %10zu %10zu %7.1f%% %10.1f %10.1f %+7.1f%% %6.1f%%%s\n", format->name, size->name,
+        result.input_length, result.output_length, 100.0 - 100.0 * result.output_length / result.input_length,
+        result.input_length / median(seconds, BENCH_COMPARE_ROUNDS) / 1e6,
+        baseline_result.input_length / median(baseline_seconds, BENCH_COMPARE_ROUNDS) / 1e6, change_percent,
+        noise_percent, *regression ? " REGRESSION" : "");
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    uint64_t seed = 1;
+    const char *format_name = NULL;
+    const char *size_name = NULL;
+    const char *baseline_program = NULL;
+    const char *documents_directory = NULL;
+    bool child = false;
+    double threshold_percent = 10;
+    struct MinifyOptions options = default_options;
+    options.threads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        bool valid = i + 1 < argc;
+        char *end;
+        if (valid && !strcmp(argv[i], "--seed")) {
+            seed = strtoull(argv[++i], &end, 10);
+            valid = *end == '\0' && end != argv[i];
+        }
+        else if (valid && !strcmp(argv[i], "--threads")) {
+            unsigned long threads = strtoul(argv[++i], &end, 10);
+            valid = *end == '\0' && threads > 0 && threads <= 1024;
+            options.threads = threads;
+        }
+        else if (valid && !strcmp(argv[i], "--format")) {
+            format_name = argv[++i];
+        }
+        else if (valid && !strcmp(argv[i], "--size")) {
+            size_name = argv[++i];
+        }
+        else if (valid && !strcmp(argv[i], "--compare")) {
+            baseline_program = argv[++i];
+        }
+        else if (valid && !strcmp(argv[i], "--threshold")) {
+            threshold_percent = strtod(argv[++i], &end);
+            valid = *end == '\0' && end != argv[i] && threshold_percent >= 0;
+        }
+        else if (valid && !strcmp(argv[i], "--write-documents")) {
+            documents_directory = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--child")) {
+            // Used by --compare on the baseline build, which writes the result of one measurement to the
+            // standard output
+            child = valid = true;
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            fputs("Usage: ", stderr);
+            fputs(argv[0], stderr);
+            fputs(" [--seed N] [--threads N] [--format json|css|js|xml|html] [--size small|medium|large]"
+                " [--compare BASELINE_BENCH [--threshold PERCENT]] [--write-documents DIRECTORY]\n", stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (child) {
+        for (size_t f = 0; f < sizeof bench_formats / sizeof *bench_formats; ++f) {
+            for (size_t s = 0; s < sizeof bench_sizes / sizeof *bench_sizes; ++s) {
+                if (format_name != NULL && size_name != NULL && !strcmp(format_name, bench_formats[f].name) &&
+                    !strcmp(size_name, bench_sizes[s].name))
+                {
+                    struct BenchResult result = bench_run(&bench_formats[f], &bench_sizes[s], seed, &options);
+                    bool written = fwrite(&result, sizeof result, 1, stdout) == 1 && fflush(stdout) == 0;
+                    return written && result.success ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+            }
+        }
+        fputs("No benchmark matches the given format and size\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    // Only writes the documents without measuring anything
+
+    if (documents_directory != NULL) {
+        bool matched = false;
+        for (size_t f = 0; f < sizeof bench_formats / sizeof *bench_formats; ++f) {
+            for (size_t s = 0; s < sizeof bench_sizes / sizeof *bench_sizes; ++s) {
+                if (format_name != NULL && strcmp(format_name, bench_formats[f].name) ||
+                    size_name != NULL && strcmp(size_name, bench_sizes[s].name))
+                {
+                    continue;
+                }
+                matched = true;
+                if (!write_document(&bench_formats[f], &bench_sizes[s], seed, documents_directory)) {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        if (!matched) {
+            fputs("No benchmark matches the given format and size\n", stderr);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (baseline_program == NULL) {
+        printf("Seed %llu, %u thread(s), median of at least %d runs\n\n", (unsigned long long) seed,
+            options.threads, BENCH_MIN_RUNS);
+        printf("%-6s %-7s %10s %10s %8s %6s %10s %7s %9s %10s\n", "format", "size", "input", "output", "saved",
+            "runs", "MB/s", "MAD", "ns/byte", "peak KiB");
+    }
+    else {
+        printf("Seed %llu, %u thread(s), %d rounds alternating with %s\n\n", (unsigned long long) seed,
+            options.threads, BENCH_COMPARE_ROUNDS, baseline_program);
+        printf("%-6s %-7s %10s %10s %8s %10s %10s %8s %7s\n", "format", "size", "input", "output", "saved",
+            "MB/s", "baseline", "change", "noise");
+    }
+    bool success = true;
+    size_t regressions = 0;
+    bool matched = false;
+    for (size_t f = 0; f < sizeof bench_formats / sizeof *bench_formats; ++f) {
+        for (size_t s = 0; s < sizeof bench_sizes / sizeof *bench_sizes; ++s) {
+            if (format_name != NULL && strcmp(format_name, bench_formats[f].name) ||
+                size_name != NULL && strcmp(size_name, bench_sizes[s].name))
+            {
+                continue;
+            }
+            matched = true;
+            if (baseline_program != NULL) {
+                bool regression;
+                if (!bench_compare(&bench_formats[f], &bench_sizes[s], seed, &options, baseline_program,
+                    threshold_percent, &regression))
+                {
+                    success = false;
+                }
+                else {
+                    regressions += regression;
+                }
+                continue;
+            }
+            struct BenchResult result;
+            if (!bench_measure(&bench_formats[f], &bench_sizes[s], seed, &options, NULL, &result)) {
+                success = false;
+                continue;
+            }
+            printf("%-6s %-7s %10zu %10zu %7.1f%% %6zu %10.1f %6.1f%% %9.2f %10ld\n", bench_formats[f].name,
+                bench_sizes[s].name, result.input_length, result.output_length,
+                100.0 - 100.0 * result.output_length / result.input_length, result.runs,
+                result.input_length / result.median_seconds / 1e6, 100 * result.mad_seconds / result.median_seconds,
+                result.median_seconds * 1e9 / result.input_length, result.peak_rss_kib);
+        }
+    }
+    if (!matched) {
+        fputs("No benchmark matches the given format and size\n", stderr);
+        return EXIT_FAILURE;
+    }
+    if (regressions > 0) {
+        printf("\n%zu benchmark(s) are more than %.1f%% plus %d MADs of the noise slower than the baseline\n",
+            regressions, threshold_percent, BENCH_NOISE_MADS);
+        return EXIT_FAILURE;
+    }
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,6 +5,13 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Forces inlining into callers that pass constants, which compiles a specialized copy for each constant
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 
 static char *file_get_content(const char *filename)
 {
@@ -42,6 +49,10 @@ static char *file_get_content(const char *filename)
         }
         buffer = larger_buffer;
     } while (feof(fp) == 0);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    buffer[read] = '\0';
     return buffer;
 }
 
@@ -50,6 +61,26 @@ static bool is_whitespace(const char c)
     return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
+static uint64_t hash_bytes(const char *data, size_t length)
+{
+    // A fast non-cryptographic hash, mixing in eight bytes per step
+
+    uint64_t hash = 0x9E3779B97F4A7C15u ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, &data[i], 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDu;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, &data[i], length - i);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53u;
+    hash ^= hash >> 29;
+    hash *= 0xFF51AFD7ED558CCDu;
+    return hash ^ (hash >> 32);
+}
+
 struct Minification
 {
     char *result;
@@ -57,12 +88,90 @@ struct Minification
     size_t error_position;
 };
 
+// Statistics
+//
+// Building with `make CMINIFY_STATS=1` compiles counters into the minifiers, which are printed to the
+// standard error at exit. They show which input features the time goes to. In the default build,
+// STATS_ADD compiles to nothing.
+
+#ifdef CMINIFY_STATS
+
+enum StatsCounter
+{
+    STATS_SKIP_WHITESPACES_COMMENTS_CALLS, STATS_SKIP_WHITESPACES_COMMENTS_BYTES,
+
+    // In the order of the syntax blocks in `minify_css_block_into`
+    STATS_CSS_ENTER_STYLE, STATS_CSS_ENTER_RULE_START, STATS_CSS_ENTER_QRULE, STATS_CSS_ENTER_QRULE_ROUND_BRACKETS,
+    STATS_CSS_ENTER_QRULE_SQUARE_BRACKETS, STATS_CSS_ENTER_ATRULE, STATS_CSS_ENTER_ATRULE_ROUND_BRACKETS,
+    STATS_CSS_ENTER_ATRULE_SQUARE_BRACKETS,
+
+    // In the order of `stats_js_keywords`
+    STATS_JS_KEYWORD_SWITCH, STATS_JS_KEYWORD_CATCH, STATS_JS_KEYWORD_DO, STATS_JS_KEYWORD_TRY,
+    STATS_JS_KEYWORD_FINALLY, STATS_JS_KEYWORD_FUNCTION, STATS_JS_KEYWORD_WHILE, STATS_JS_KEYWORD_IF,
+    STATS_JS_KEYWORD_FOR, STATS_JS_KEYWORD_ELSE, STATS_JS_KEYWORD_TRUE, STATS_JS_KEYWORD_FALSE,
+
+    STATS_JSON_BRACKETS_REALLOC, STATS_JS_CURLY_BLOCKS_REALLOC, STATS_JS_ROUND_BLOCKS_REALLOC,
+    STATS_HTML_ELEMENTS_REALLOC,
+    STATS_COUNTER_COUNT
+};
+
+static const char *const stats_counter_names[STATS_COUNTER_COUNT] = {
+    "skip_whitespaces_comments_calls", "skip_whitespaces_comments_bytes",
+    "css_enter_style", "css_enter_rule_start", "css_enter_qrule", "css_enter_qrule_round_brackets",
+    "css_enter_qrule_square_brackets", "css_enter_atrule", "css_enter_atrule_round_brackets",
+    "css_enter_atrule_square_brackets",
+    "js_keyword_switch", "js_keyword_catch", "js_keyword_do", "js_keyword_try", "js_keyword_finally",
+    "js_keyword_function", "js_keyword_while", "js_keyword_if", "js_keyword_for", "js_keyword_else",
+    "js_keyword_true", "js_keyword_false",
+    "json_brackets_realloc", "js_curly_blocks_realloc", "js_round_blocks_realloc", "html_elements_realloc",
+};
+
+static const char *const stats_js_keywords[] = {
+    "switch", "catch", "do", "try", "finally", "function", "while", "if", "for", "else", "true", "false"
+};
+
+// Inline blocks are minified by several threads, so the counters are updated atomically
+static unsigned long long stats_counters[STATS_COUNTER_COUNT];
+
+#define STATS_ADD(counter, n) __atomic_fetch_add(&stats_counters[counter], (n), __ATOMIC_RELAXED)
+
+static void stats_print(void)
+{
+    for (size_t k = 0; k < STATS_COUNTER_COUNT; ++k) {
+        fprintf(stderr, "%-36s %llu\n", stats_counter_names[k], stats_counters[k]);
+    }
+}
+
+__attribute__((constructor)) static void stats_register(void)
+{
+    atexit(stats_print);
+}
+
+static void stats_add_js_keyword(const char *word, size_t length)
+{
+    for (size_t k = 0; k < sizeof stats_js_keywords / sizeof *stats_js_keywords; ++k) {
+        if (length == strlen(stats_js_keywords[k]) && !strncmp(word, stats_js_keywords[k], length)) {
+            STATS_ADD(STATS_JS_KEYWORD_SWITCH + k, 1);
+        }
+    }
+}
+
+#else
+
+#define STATS_ADD(counter, n) ((void) 0)
+
+#endif
+
 enum CommentVariant {COMMENT_VARIANT_CSS, COMMENT_VARIANT_JS};
 
 static bool skip_whitespaces_comments(struct Minification *m, const char *input, size_t *i, char *min,
     size_t *min_length, enum CommentVariant comment_variant)
 {
     bool skipped_all_comments = true;
+#ifdef CMINIFY_STATS
+    size_t stats_start = *i;
+    STATS_ADD(STATS_SKIP_WHITESPACES_COMMENTS_CALLS, 1);
+#endif
     do {
         while (is_whitespace(input[*i])) {
             *i += 1;
@@ -106,6 +215,7 @@ static bool skip_whitespaces_comments(struct Minification *m, const char *input,
             }
         }
     } while (true);
+    STATS_ADD(STATS_SKIP_WHITESPACES_COMMENTS_BYTES, *i - stats_start);
     return skipped_all_comments;
 }
 
@@ -133,13 +243,370 @@ int strnicmp(const char *s1, const char *s2, size_t length)
     return diff;
 }
 
-struct Minification minify_css(const char *css)
+// Tag and attribute names are case-sensitive in XML but not in HTML
+static ALWAYS_INLINE int tagncmp(bool is_xml, const char *s1, const char *s2, size_t length)
 {
-    struct Minification m = {.result = malloc(strlen(css) + 1)};
-    if (m.result == NULL) {
-        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
-        return m;
+    return is_xml ? strncmp(s1, s2, length) : strnicmp(s1, s2, length);
+}
+
+static bool word_is_one_of(const char *word, size_t length, const char *words)
+{
+    // `words` is a space-separated list, compared case-insensitively
+
+    while (*words != '\0') {
+        size_t word_length = strcspn(words, " ");
+        if (word_length == length && !strnicmp(word, words, length)) {
+            return true;
+        }
+        words += word_length + (words[word_length] == ' ');
+    }
+    return false;
+}
+
+// CSS colors
+//
+// Colors in declaration values are written in their shortest form: `#aabbcc` and `rgb(170,187,204)`
+// become `#abc`, `#ff0000` becomes `red` and `white` becomes `#fff`. Keywords are only replaced in
+// properties that take colors, because for example `animation-name: tan` is not a color.
+
+static const struct NamedColor
+{
+    const char *name;
+    uint_fast32_t rgb;
+} named_colors[] = {
+    {"aliceblue", 0xF0F8FF}, {"antiquewhite", 0xFAEBD7}, {"aqua", 0x00FFFF}, {"aquamarine", 0x7FFFD4},
+    {"azure", 0xF0FFFF}, {"beige", 0xF5F5DC}, {"bisque", 0xFFE4C4}, {"black", 0x000000},
+    {"blanchedalmond", 0xFFEBCD}, {"blue", 0x0000FF}, {"blueviolet", 0x8A2BE2}, {"brown", 0xA52A2A},
+    {"burlywood", 0xDEB887}, {"cadetblue", 0x5F9EA0}, {"chartreuse", 0x7FFF00}, {"chocolate", 0xD2691E},
+    {"coral", 0xFF7F50}, {"cornflowerblue", 0x6495ED}, {"cornsilk", 0xFFF8DC}, {"crimson", 0xDC143C},
+    {"cyan", 0x00FFFF}, {"darkblue", 0x00008B}, {"darkcyan", 0x008B8B}, {"darkgoldenrod", 0xB8860B},
+    {"darkgray", 0xA9A9A9}, {"darkgreen", 0x006400}, {"darkgrey", 0xA9A9A9}, {"darkkhaki", 0xBDB76B},
+    {"darkmagenta", 0x8B008B}, {"darkolivegreen", 0x556B2F}, {"darkorange", 0xFF8C00},
+    {"darkorchid", 0x9932CC}, {"darkred", 0x8B0000}, {"darksalmon", 0xE9967A}, {"darkseagreen", 0x8FBC8F},
+    {"darkslateblue", 0x483D8B}, {"darkslategray", 0x2F4F4F}, {"darkslategrey", 0x2F4F4F},
+    {"darkturquoise", 0x00CED1}, {"darkviolet", 0x9400D3}, {"deeppink", 0xFF1493}, {"deepskyblue", 0x00BFFF},
+    {"dimgray", 0x696969}, {"dimgrey", 0x696969}, {"dodgerblue", 0x1E90FF}, {"firebrick", 0xB22222},
+    {"floralwhite", 0xFFFAF0}, {"forestgreen", 0x228B22}, {"fuchsia", 0xFF00FF}, {"gainsboro", 0xDCDCDC},
+    {"ghostwhite", 0xF8F8FF}, {"gold", 0xFFD700}, {"goldenrod", 0xDAA520}, {"gray", 0x808080},
+    {"green", 0x008000}, {"greenyellow", 0xADFF2F}, {"grey", 0x808080}, {"honeydew", 0xF0FFF0},
+    {"hotpink", 0xFF69B4}, {"indianred", 0xCD5C5C}, {"indigo", 0x4B0082}, {"ivory", 0xFFFFF0},
+    {"khaki", 0xF0E68C}, {"lavender", 0xE6E6FA}, {"lavenderblush", 0xFFF0F5}, {"lawngreen", 0x7CFC00},
+    {"lemonchiffon", 0xFFFACD}, {"lightblue", 0xADD8E6}, {"lightcoral", 0xF08080}, {"lightcyan", 0xE0FFFF},
+    {"lightgoldenrodyellow", 0xFAFAD2}, {"lightgray", 0xD3D3D3}, {"lightgreen", 0x90EE90},
+    {"lightgrey", 0xD3D3D3}, {"lightpink", 0xFFB6C1}, {"lightsalmon", 0xFFA07A}, {"lightseagreen", 0x20B2AA},
+    {"lightskyblue", 0x87CEFA}, {"lightslategray", 0x778899}, {"lightslategrey", 0x778899},
+    {"lightsteelblue", 0xB0C4DE}, {"lightyellow", 0xFFFFE0}, {"lime", 0x00FF00}, {"limegreen", 0x32CD32},
+    {"linen", 0xFAF0E6}, {"magenta", 0xFF00FF}, {"maroon", 0x800000}, {"mediumaquamarine", 0x66CDAA},
+    {"mediumblue", 0x0000CD}, {"mediumorchid", 0xBA55D3}, {"mediumpurple", 0x9370DB},
+    {"mediumseagreen", 0x3CB371}, {"mediumslateblue", 0x7B68EE}, {"mediumspringgreen", 0x00FA9A},
+    {"mediumturquoise", 0x48D1CC}, {"mediumvioletred", 0xC71585}, {"midnightblue", 0x191970},
+    {"mintcream", 0xF5FFFA}, {"mistyrose", 0xFFE4E1}, {"moccasin", 0xFFE4B5}, {"navajowhite", 0xFFDEAD},
+    {"navy", 0x000080}, {"oldlace", 0xFDF5E6}, {"olive", 0x808000}, {"olivedrab", 0x6B8E23},
+    {"orange", 0xFFA500}, {"orangered", 0xFF4500}, {"orchid", 0xDA70D6}, {"palegoldenrod", 0xEEE8AA},
+    {"palegreen", 0x98FB98}, {"paleturquoise", 0xAFEEEE}, {"palevioletred", 0xDB7093},
+    {"papayawhip", 0xFFEFD5}, {"peachpuff", 0xFFDAB9}, {"peru", 0xCD853F}, {"pink", 0xFFC0CB},
+    {"plum", 0xDDA0DD}, {"powderblue", 0xB0E0E6}, {"purple", 0x800080}, {"rebeccapurple", 0x663399},
+    {"red", 0xFF0000}, {"rosybrown", 0xBC8F8F}, {"royalblue", 0x4169E1}, {"saddlebrown", 0x8B4513},
+    {"salmon", 0xFA8072}, {"sandybrown", 0xF4A460}, {"seagreen", 0x2E8B57}, {"seashell", 0xFFF5EE},
+    {"sienna", 0xA0522D}, {"silver", 0xC0C0C0}, {"skyblue", 0x87CEEB}, {"slateblue", 0x6A5ACD},
+    {"slategray", 0x708090}, {"slategrey", 0x708090}, {"snow", 0xFFFAFA}, {"springgreen", 0x00FF7F},
+    {"steelblue", 0x4682B4}, {"tan", 0xD2B48C}, {"teal", 0x008080}, {"thistle", 0xD8BFD8},
+    {"tomato", 0xFF6347}, {"turquoise", 0x40E0D0}, {"violet", 0xEE82EE}, {"wheat", 0xF5DEB3},
+    {"white", 0xFFFFFF}, {"whitesmoke", 0xF5F5F5}, {"yellow", 0xFFFF00}, {"yellowgreen", 0x9ACD32},
+};
+
+static bool is_css_identifier_char(char c)
+{
+    return isalnum((unsigned char) c) || c == '-' || c == '_' || c == '\\' || (unsigned char) c >= 0x80;
+}
+
+static bool is_css_color_property(const char *property, size_t length)
+{
+    if (length > 2 && property[0] == '-' && property[1] != '-') {
+        // Vendor prefix like `-webkit-`
+        const char *prefix_end = memchr(&property[1], '-', length - 1);
+        if (prefix_end == NULL) {
+            return false;
+        }
+        length -= prefix_end + 1 - property;
+        property = prefix_end + 1;
+    }
+    for (size_t k = 0; k + sizeof "color" - 1 <= length; ++k) {
+        if (!strnicmp(&property[k], "color", sizeof "color" - 1)) {
+            return true;
+        }
+    }
+    return word_is_one_of(property, length,
+        "background border border-top border-right border-bottom border-left border-block border-inline "
+        "border-block-start border-block-end border-inline-start border-inline-end outline box-shadow "
+        "text-shadow fill stroke column-rule text-decoration text-emphasis");
+}
+
+static size_t write_css_color(uint_fast32_t rgb, char *result)
+{
+    // Writes the shortest notation of an opaque color
+
+    static const char hex_digits[] = "0123456789abcdef";
+    bool is_short = ((rgb >> 20) & 0xF) == ((rgb >> 16) & 0xF) && ((rgb >> 12) & 0xF) == ((rgb >> 8) & 0xF) &&
+        ((rgb >> 4) & 0xF) == (rgb & 0xF);
+    size_t length = is_short ? sizeof "#rgb" - 1 : sizeof "#rrggbb" - 1;
+    for (size_t k = 0; k < sizeof named_colors / sizeof *named_colors; ++k) {
+        if (named_colors[k].rgb == rgb && strlen(named_colors[k].name) < length) {
+            memcpy(result, named_colors[k].name, strlen(named_colors[k].name));
+            return strlen(named_colors[k].name);
+        }
+    }
+    result[0] = '#';
+    if (is_short) {
+        result[1] = hex_digits[(rgb >> 20) & 0xF];
+        result[2] = hex_digits[(rgb >> 12) & 0xF];
+        result[3] = hex_digits[(rgb >> 4) & 0xF];
+    }
+    else {
+        for (size_t k = 0; k < 6; ++k) {
+            result[1 + k] = hex_digits[(rgb >> (20 - 4 * k)) & 0xF];
+        }
+    }
+    return length;
+}
+
+static size_t minify_css_hex_color(const char *css, char *result, size_t *result_length)
+{
+    // Returns the length of the hex color at `css` or 0 if there is none
+
+    static const char hex_digits[] = "0123456789abcdef";
+    size_t digits = 0;
+    uint_fast32_t value = 0;
+    while (isxdigit((unsigned char) css[1 + digits]) && digits < 8) {
+        char digit = tolower((unsigned char) css[1 + digits]);
+        value = value * 16 + (isdigit(digit) ? digit - '0' : digit - 'a' + 10);
+        digits += 1;
+    }
+    if (digits != 3 && digits != 4 && digits != 6 && digits != 8 || is_css_identifier_char(css[1 + digits])) {
+        return 0;
+    }
+    size_t length = 1 + digits;
+    if (digits == 3 || digits == 4) {
+        // Expanding `#rgba` to `0xrrggbbaa`
+        uint_fast32_t expanded = 0;
+        for (size_t k = 0; k < digits; ++k) {
+            uint_fast32_t nibble = (value >> (4 * (digits - 1 - k))) & 0xF;
+            expanded = (expanded << 8) | (nibble << 4) | nibble;
+        }
+        value = expanded;
+        digits *= 2;
+    }
+    if (digits == 6 || (value & 0xFF) == 0xFF) {
+        *result_length += write_css_color(digits == 6 ? value : value >> 8, &result[*result_length]);
+        return length;
+    }
+    bool is_short = true;
+    for (size_t k = 0; k < 4; ++k) {
+        is_short = is_short && ((value >> (8 * k + 4)) & 0xF) == ((value >> (8 * k)) & 0xF);
+    }
+    result[(*result_length)++] = '#';
+    for (size_t k = 0; k < 8; k += 1 + is_short) {
+        result[(*result_length)++] = hex_digits[(value >> (28 - 4 * k)) & 0xF];
+    }
+    return length;
+}
+
+static size_t minify_css_rgb_color(const char *css, char *result, size_t *result_length)
+{
+    // Returns the length of `rgb(…)` or `rgba(…)` at `css` if it has integer components and is opaque,
+    // otherwise 0
+
+    size_t i = strnicmp(css, "rgba(", sizeof "rgba(" - 1) ? sizeof "rgb(" - 1 : sizeof "rgba(" - 1;
+    uint_fast32_t rgb = 0;
+    for (size_t component = 0; component < 3; ++component) {
+        while (is_whitespace(css[i])) {
+            i += 1;
+        }
+        if (component > 0 && css[i] == ',') {
+            i += 1;
+            while (is_whitespace(css[i])) {
+                i += 1;
+            }
+        }
+        else if (component > 0 && !is_whitespace(css[i - 1])) {
+            return 0;
+        }
+        uint_fast32_t value = 0;
+        size_t digits = 0;
+        while (isdigit((unsigned char) css[i]) && digits < 4) {
+            value = value * 10 + css[i] - '0';
+            digits += 1;
+            i += 1;
+        }
+        if (digits == 0 || value > 255 || css[i] == '.' || css[i] == '%' || is_css_identifier_char(css[i])) {
+            return 0;
+        }
+        rgb = (rgb << 8) | value;
+    }
+    while (is_whitespace(css[i])) {
+        i += 1;
+    }
+    if (css[i] == ',' || css[i] == '/') {
+        i += 1;
+        while (is_whitespace(css[i])) {
+            i += 1;
+        }
+        if (!strncmp(&css[i], "100%", sizeof "100%" - 1)) {
+            i += sizeof "100%" - 1;
+        }
+        else if (css[i] == '1' && !isdigit((unsigned char) css[i + 1]) && css[i + 1] != '.' && css[i + 1] != '%') {
+            i += 1;
+        }
+        else {
+            return 0;
+        }
+        while (is_whitespace(css[i])) {
+            i += 1;
+        }
+    }
+    if (css[i] != ')') {
+        return 0;
+    }
+    *result_length += write_css_color(rgb, &result[*result_length]);
+    return i + 1;
+}
+
+static size_t minify_css_named_color(const char *css, size_t length, char *result, size_t *result_length)
+{
+    // Returns `length` if the keyword is a color that has a shorter hex notation, otherwise 0
+
+    for (size_t k = 0; k < sizeof named_colors / sizeof *named_colors; ++k) {
+        if (strlen(named_colors[k].name) == length && !strnicmp(css, named_colors[k].name, length)) {
+            char color[sizeof "#rrggbb"];
+            size_t color_length = write_css_color(named_colors[k].rgb, color);
+            if (color_length >= length) {
+                return 0;
+            }
+            memcpy(&result[*result_length], color, color_length);
+            *result_length += color_length;
+            return length;
+        }
+    }
+    return 0;
+}
+
+static size_t minify_css_number(const char *css, bool is_value, bool keep_zero_unit, char *result,
+    size_t *result_length)
+{
+    // Writes the number at `css` in its shortest form and returns its length, or 0 if there is no number.
+    // Outside of declaration values and media queries only the leading zero is removed, because for
+    // example `[x="+1"]` and `[x=+1]` are different selectors. Zero lengths lose their unit unless
+    // `keep_zero_unit` is set, for example in `calc()`.
+
+    size_t i = 0;
+    if (css[i] == '+' || css[i] == '-') {
+        i += 1;
+    }
+    size_t integer_start = i;
+    while (isdigit((unsigned char) css[i])) {
+        i += 1;
+    }
+    size_t integer_end = i;
+    size_t fraction_start = i, fraction_end = i;
+    if (css[i] == '.' && isdigit((unsigned char) css[i + 1])) {
+        fraction_start = i + 1;
+        i += 1;
+        while (isdigit((unsigned char) css[i])) {
+            i += 1;
+        }
+        fraction_end = i;
+    }
+    if (integer_end == integer_start && fraction_end == fraction_start) {
+        return 0;
+    }
+    size_t exponent_start = i, exponent_end = i;
+    bool is_negative_exponent = false;
+    if ((css[i] == 'e' || css[i] == 'E') &&
+        (isdigit((unsigned char) css[i + 1]) ||
+        (css[i + 1] == '+' || css[i + 1] == '-') && isdigit((unsigned char) css[i + 2])))
+    {
+        i += 1;
+        if (css[i] == '+' || css[i] == '-') {
+            is_negative_exponent = css[i] == '-';
+            i += 1;
+        }
+        exponent_start = i;
+        while (isdigit((unsigned char) css[i])) {
+            i += 1;
+        }
+        exponent_end = i;
+    }
+
+    if (!is_value) {
+        if (css[integer_start] == '0' && integer_end == integer_start + 1 && fraction_end > fraction_start) {
+            // Converting for example `0.1` to `.1`
+            memcpy(&result[*result_length], css, integer_start);
+            *result_length += integer_start;
+            memcpy(&result[*result_length], &css[integer_end], i - integer_end);
+            *result_length += i - integer_end;
+        }
+        else {
+            memcpy(&result[*result_length], css, i);
+            *result_length += i;
+        }
+        return i;
+    }
+
+    while (integer_start < integer_end && css[integer_start] == '0') {
+        integer_start += 1;
+    }
+    while (fraction_end > fraction_start && css[fraction_end - 1] == '0') {
+        fraction_end -= 1;
+    }
+    while (exponent_start < exponent_end && css[exponent_start] == '0') {
+        exponent_start += 1;
+    }
+    bool is_zero = integer_start == integer_end && fraction_start == fraction_end;
+
+    if (css[0] == '-') {
+        result[(*result_length)++] = '-';
+    }
+    if (is_zero) {
+        result[(*result_length)++] = '0';
+    }
+    else {
+        memcpy(&result[*result_length], &css[integer_start], integer_end - integer_start);
+        *result_length += integer_end - integer_start;
+        if (fraction_end > fraction_start) {
+            result[(*result_length)++] = '.';
+            memcpy(&result[*result_length], &css[fraction_start], fraction_end - fraction_start);
+            *result_length += fraction_end - fraction_start;
+        }
+        if (exponent_end > exponent_start) {
+            result[(*result_length)++] = 'e';
+            if (is_negative_exponent) {
+                result[(*result_length)++] = '-';
+            }
+            memcpy(&result[*result_length], &css[exponent_start], exponent_end - exponent_start);
+            *result_length += exponent_end - exponent_start;
+        }
+    }
+
+    if (is_zero && !keep_zero_unit) {
+        size_t unit_length = 0;
+        while (isalpha((unsigned char) css[i + unit_length])) {
+            unit_length += 1;
+        }
+        if (!is_css_identifier_char(css[i + unit_length]) &&
+            word_is_one_of(&css[i], unit_length, "px em rem ex ch vw vh vmin vmax cm mm in pt pc q"))
+        {
+            i += unit_length;
+        }
     }
+    return i;
+}
+
+static struct Minification minify_css_block_into(const char *css, bool is_declaration_list, char *result,
+    size_t *result_length_out)
+{
+    // A declaration list is the content of a `style` attribute, for example `color: red; margin: 0`
+
+    struct Minification m = {.result = result};
 
     enum {
         SYNTAX_BLOCK_STYLE,
@@ -150,23 +617,40 @@ struct Minification minify_css(const char *css)
         SYNTAX_BLOCK_ATRULE,
         SYNTAX_BLOCK_ATRULE_ROUND_BRACKETS,
         SYNTAX_BLOCK_ATRULE_SQUARE_BRACKETS,
-    } syntax_block = SYNTAX_BLOCK_RULE_START;
+    } syntax_block = is_declaration_list ? SYNTAX_BLOCK_STYLE : SYNTAX_BLOCK_RULE_START;
     size_t result_length = 0;
     const char *atrule = NULL;
     size_t atrule_length;
     size_t i = 0;
     size_t nesting_level = 0;
+    const char *property = NULL;
+    size_t property_length = 0;
+    bool in_declaration_value = false;
+    size_t value_parenthesis_depth = 0;
+    bool in_progid_value = false;
 
-    #define CSS_SKIP_WHITESPACES_COMMENTS(css, ptr_i, result, ptr_result_length) \
-        skip_whitespaces_comments(&m, css, ptr_i, result, ptr_result_length, COMMENT_VARIANT_CSS); \
-        if (m.error_position != 0) { \
+    #define CSS_SKIP_WHITESPACES_COMMENTS(css, ptr_i, min, ptr_min_length) \
+        skip_whitespaces_comments(&m, css, ptr_i, min, ptr_min_length, COMMENT_VARIANT_CSS); \
+        if (m.result == NULL) { \
             goto error; \
         }
 
+#ifdef CMINIFY_STATS
+    int stats_syntax_block = -1;
+#endif
+
     CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
     while (true) {
+#ifdef CMINIFY_STATS
+        if ((int) syntax_block != stats_syntax_block) {
+            stats_syntax_block = syntax_block;
+            STATS_ADD(STATS_CSS_ENTER_STYLE + syntax_block, 1);
+        }
+#endif
         if (css[i] == '\0') {
-            if (syntax_block != SYNTAX_BLOCK_RULE_START) {
+            if (syntax_block != SYNTAX_BLOCK_RULE_START &&
+                (syntax_block != SYNTAX_BLOCK_STYLE || !is_declaration_list))
+            {
                 while (i > 0 && is_whitespace(css[i - 1])) {
                     i -= 1;
                 }
@@ -202,6 +686,10 @@ struct Minification minify_css(const char *css)
                 m.result[result_length++] = '}';
                 nesting_level -= 1;
                 i += 1;
+                property = NULL;
+                in_declaration_value = false;
+                value_parenthesis_depth = 0;
+                in_progid_value = false;
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
             } while (css[i] == '}');
             syntax_block = SYNTAX_BLOCK_RULE_START;
@@ -297,7 +785,7 @@ struct Minification minify_css(const char *css)
                 active_backslash = !active_backslash;
                 m.result[result_length++] = css[i++];
             }
-            if (active_backslash) {
+            if (active_backslash && css[i] != '\0') {
                 m.result[result_length++] = css[i++];
             }
             continue;
@@ -321,11 +809,15 @@ struct Minification minify_css(const char *css)
             continue;
         }
         if (css[i] == ';' && syntax_block != SYNTAX_BLOCK_QRULE) {
+            property = NULL;
+            in_declaration_value = false;
+            value_parenthesis_depth = 0;
+            in_progid_value = false;
             do {
                 i += 1;
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
             } while (css[i] == ';');
-            if (css[i] != '}') {
+            if (css[i] != '}' && (css[i] != '\0' || !is_declaration_list)) {
                 m.result[result_length++] = ';';
             }
             if (syntax_block == SYNTAX_BLOCK_ATRULE) {
@@ -334,6 +826,10 @@ struct Minification minify_css(const char *css)
             continue;
         }
         if (css[i] == '{') {
+            property = NULL;
+            in_declaration_value = false;
+            value_parenthesis_depth = 0;
+            in_progid_value = false;
             nesting_level += 1;
             if (syntax_block == SYNTAX_BLOCK_STYLE)  {
                 m.error_position = i;
@@ -364,10 +860,25 @@ struct Minification minify_css(const char *css)
             }
             continue;
         }
-        if (css[i] == '0' && css[i + 1] == '.' && (i == 0 || css[i - 1] < '0' || css[i - 1] > '9')) {
-            // Converting for example `0.1` to `.1`
-            i += 1;
-            continue;
+        // Shortening numbers, except the hexadecimal code points in `unicode-range: U+1E00-1E9F` that look like
+        // numbers with exponents
+
+        if ((isdigit((unsigned char) css[i]) || strchr("+-.", css[i]) != NULL) &&
+            (i == 0 || !is_css_identifier_char(css[i - 1]) && css[i - 1] != '.' && css[i - 1] != '#') &&
+            !(in_declaration_value && property_length == sizeof "unicode-range" - 1 &&
+            !strnicmp(property, "unicode-range", property_length)))
+        {
+            bool is_custom_property = property != NULL && property[0] == '-' && property[1] == '-';
+            bool is_value = syntax_block == SYNTAX_BLOCK_STYLE && in_declaration_value && !is_custom_property ||
+                syntax_block == SYNTAX_BLOCK_ATRULE_ROUND_BRACKETS;
+            bool keep_zero_unit = syntax_block != SYNTAX_BLOCK_STYLE || value_parenthesis_depth > 0 ||
+                in_declaration_value && property_length >= sizeof "flex" - 1 &&
+                !strnicmp(property, "flex", sizeof "flex" - 1);
+            size_t number_length = minify_css_number(&css[i], is_value, keep_zero_unit, m.result, &result_length);
+            if (number_length > 0) {
+                i += number_length;
+                continue;
+            }
         }
         if (css[i] == '(' && syntax_block == SYNTAX_BLOCK_ATRULE) {
             syntax_block = SYNTAX_BLOCK_ATRULE_ROUND_BRACKETS;
@@ -418,6 +929,12 @@ struct Minification minify_css(const char *css)
             continue;
         }
         if (is_whitespace(css[i]) || css[i] == '/' && css[i + 1] == '*') {
+            // A space replaces the skipped whitespace and comments only if that keeps the result shorter than
+            // the input, which is not the case after a preserved comment that is not followed by whitespace
+
+            size_t before_whitespace = i;
+            size_t result_length_before_whitespace = result_length;
+            #define CSS_SPACE_FITS (i - before_whitespace > result_length - result_length_before_whitespace)
             if (syntax_block == SYNTAX_BLOCK_ATRULE_ROUND_BRACKETS ||
                 syntax_block == SYNTAX_BLOCK_QRULE_ROUND_BRACKETS)
             {
@@ -425,7 +942,7 @@ struct Minification minify_css(const char *css)
 
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
                 if (strchr("(,<>:", m.result[result_length - 1]) == NULL &&
-                    strchr("),<>:", css[i]) == NULL)
+                    strchr("),<>:", css[i]) == NULL && CSS_SPACE_FITS)
                 {
                     m.result[result_length++] = ' ';
                 }
@@ -435,20 +952,19 @@ struct Minification minify_css(const char *css)
             {
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
                 if (strchr("[=,", m.result[result_length - 1]) == NULL &&
-                    strchr("]=,*$^-|", css[i]) == NULL)
+                    strchr("]=,*$^-|", css[i]) == NULL && CSS_SPACE_FITS)
                 {
                     m.result[result_length++] = ' ';
                 }
             }
             else if (syntax_block == SYNTAX_BLOCK_ATRULE) {
-                size_t before_whitespace = i;
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
 
                 // Removing whitespace before `(` in `@media (...){}` but not in `@media all and (...){}`
 
                 if ((css[i] != '(' || &atrule[atrule_length - 1] != &css[before_whitespace] - 1) &&
                     strchr(",)(", m.result[result_length - 1]) == NULL &&
-                    strchr(",);{", css[i]) == NULL)
+                    strchr(",);{", css[i]) == NULL && CSS_SPACE_FITS)
                 {
                     m.result[result_length++] = ' ';
                 }
@@ -456,7 +972,7 @@ struct Minification minify_css(const char *css)
             else if (syntax_block == SYNTAX_BLOCK_QRULE) {
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
                 if (strchr("~>+,]", m.result[result_length - 1]) == NULL &&
-                    strchr("~>+,[{", css[i]) == NULL)
+                    strchr("~>+,[{", css[i]) == NULL && CSS_SPACE_FITS)
                 {
                     m.result[result_length++] = ' ';
                 }
@@ -464,86 +980,336 @@ struct Minification minify_css(const char *css)
             else if (syntax_block == SYNTAX_BLOCK_STYLE) {
                 CSS_SKIP_WHITESPACES_COMMENTS(css, &i, m.result, &result_length);
                 if (strchr("{:,", m.result[result_length - 1]) == NULL &&
-                    strchr("}:,;!", css[i]) == NULL)
+                    strchr("}:,;!", css[i]) == NULL && CSS_SPACE_FITS)
                 {
                     m.result[result_length++] = ' ';
                 }
             }
+            #undef CSS_SPACE_FITS
             continue;
         }
+        if (syntax_block == SYNTAX_BLOCK_STYLE && !in_declaration_value) {
+            if (property == NULL) {
+                property = &css[i];
+            }
+            if (css[i] == ':') {
+                in_declaration_value = true;
+                property_length = &css[i] - property;
+                while (property_length > 0 && is_whitespace(property[property_length - 1])) {
+                    property_length -= 1;
+                }
+            }
+        }
+        else if (syntax_block == SYNTAX_BLOCK_STYLE && (property[0] != '-' || property[1] != '-')) {
+            // Shortening colors, except in custom properties whose values need not be colors and in IE filters
+            // like `progid:DXImageTransform.Microsoft.gradient(startColorstr=#80aabbcc)` whose colors are ARGB
+
+            if (css[i] == '(') {
+                value_parenthesis_depth += 1;
+            }
+            else if (css[i] == ')' && value_parenthesis_depth > 0) {
+                value_parenthesis_depth -= 1;
+            }
+            size_t color_length = 0;
+            if (css[i] == '#' && !in_progid_value) {
+                color_length = minify_css_hex_color(&css[i], m.result, &result_length);
+            }
+            else if (isalpha((unsigned char) css[i]) && !is_css_identifier_char(css[i - 1])) {
+                size_t identifier_length = 1;
+                while (is_css_identifier_char(css[i + identifier_length])) {
+                    identifier_length += 1;
+                }
+                if (css[i + identifier_length] == ':' && identifier_length == sizeof "progid" - 1 &&
+                    !strnicmp(&css[i], "progid", identifier_length))
+                {
+                    in_progid_value = true;
+                }
+                if (!in_progid_value && css[i + identifier_length] == '(' &&
+                    (identifier_length == sizeof "rgb" - 1 && !strnicmp(&css[i], "rgb", identifier_length) ||
+                    identifier_length == sizeof "rgba" - 1 && !strnicmp(&css[i], "rgba", identifier_length)))
+                {
+                    color_length = minify_css_rgb_color(&css[i], m.result, &result_length);
+                }
+                else if (!in_progid_value && css[i + identifier_length] != '(' &&
+                    is_css_color_property(property, property_length))
+                {
+                    color_length = minify_css_named_color(&css[i], identifier_length, m.result, &result_length);
+                }
+                if (color_length == 0) {
+                    memcpy(&m.result[result_length], &css[i], identifier_length);
+                    result_length += identifier_length;
+                    color_length = identifier_length;
+                }
+            }
+            if (color_length > 0) {
+                i += color_length;
+                continue;
+            }
+        }
         m.result[result_length++] = css[i];
         i += 1;
     }
+    *result_length_out = result_length;
     return m;
 
 error:
-    free(m.result);
     m.result = NULL;
     return m;
 }
 
-struct Minification minify_json(const char *json)
+static struct Minification minify_css_into(const char *css, char *result, size_t *result_length_out)
 {
-    struct Minification m = {.result = malloc(strlen(json) + 1)};
+    return minify_css_block_into(css, false, result, result_length_out);
+}
 
-    size_t bracket_types_capacity = 512;
-    char *bracket_types = malloc(bracket_types_capacity * sizeof *bracket_types);
+static struct Minification minify_css_declarations_into(const char *css, char *result,
+    size_t *result_length_out)
+{
+    return minify_css_block_into(css, true, result, result_length_out);
+}
 
-    if (m.result == NULL || bracket_types == NULL) {
-        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
-        goto error;
-    }
+static size_t minify_json_number(const char *json, bool canonicalize, char *result, size_t *result_length)
+{
+    // Copies the number at `json` and returns its length, or returns 0 if it is not a valid JSON number.
+    //
+    // Canonicalizing writes the shortest text that denotes exactly the same decimal value: `1.500`
+    // becomes `1.5` and `1.5E+10` becomes `15e9`. Some parsers decode `1500` as integer but `1500.0` and
+    // `15e2` as floating-point number, so integers keep their form and floating-point numbers keep a
+    // fraction or an exponent: `1.0` stays `1.0` and `1E+2` becomes `1e2`. The sign of zero is kept.
 
-    size_t nesting_level = 0;
-    size_t result_length = 0;
     size_t i = 0;
-
-    while (true) {
-        while (is_whitespace(json[i])) {
+    if (json[i] == '-') {
+        i += 1;
+    }
+    size_t integer_start = i;
+    if (json[i] == '0') {
+        i += 1;
+    }
+    else if (json[i] >= '1' && json[i] <= '9') {
+        while (json[i] >= '0' && json[i] <= '9') {
             i += 1;
         }
-        if (json[i] == '\0') {
-            m.result[result_length] = '\0';
-            break;
+    }
+    else {
+        return 0;
+    }
+    size_t integer_end = i;
+    size_t fraction_start = i, fraction_end = i;
+    if (json[i] == '.') {
+        i += 1;
+        fraction_start = i;
+        while (json[i] >= '0' && json[i] <= '9') {
+            i += 1;
         }
-        if ((json[i] == ',' || json[i] == '}') && m.result[result_length - 1] == ':') {
-            m.error_position = i;
-            snprintf(m.error, sizeof m.error, "No value after `:` in line %%zu, column %%zu\n");
-            goto error;
+        fraction_end = i;
+        if (fraction_start == fraction_end) {
+            return 0;
         }
-        if (json[i] == '[' || json[i] == '{') {
-            if (++nesting_level > bracket_types_capacity) {
-                bracket_types_capacity += 512;
-                char *bracket_types_realloc = realloc(
-                    bracket_types, bracket_types_capacity * sizeof *bracket_types);
-                if (bracket_types_realloc == NULL) {
-                    goto error;
-                }
-                bracket_types = bracket_types_realloc;
-            }
-            bracket_types[nesting_level - 1] = json[i];
-            m.result[result_length++] = json[i];
+    }
+    size_t exponent_start = i, exponent_end = i;
+    bool has_exponent = json[i] == 'e' || json[i] == 'E';
+    if (has_exponent) {
+        i += 1;
+        if (json[i] == '+' || json[i] == '-') {
             i += 1;
-            continue;
         }
-        if (json[i] == ']' || json[i] == '}') {
-            if (m.result[result_length - 1] == ',') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "Illegal `,` before bracket in line %%zu, column %%zu\n");
-                goto error;
-            }
-            if (nesting_level == 0 || bracket_types[nesting_level - 1] != json[i] - 2) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "Unexpected `%c` in line %%zu, column %%zu\n", json[i]);
-                goto error;
-            }
-            nesting_level -= 1;
-            m.result[result_length++] = json[i];
+        exponent_start = i;
+        while (json[i] >= '0' && json[i] <= '9') {
             i += 1;
-            continue;
         }
-
-        bool is_key = nesting_level > 0 && (bracket_types[nesting_level - 1] == '{' &&
+        exponent_end = i;
+        if (exponent_start == exponent_end) {
+            return 0;
+        }
+    }
+    if (json[i] >= '0' && json[i] <= '9' || json[i] == '.' || isalpha((unsigned char) json[i])) {
+        return 0;
+    }
+
+    bool is_float = fraction_start != fraction_end || has_exponent;
+    size_t exponent_digits = exponent_end - exponent_start;
+    for (size_t k = exponent_start; k < exponent_end && json[k] == '0'; ++k) {
+        exponent_digits -= 1;
+    }
+    if (!canonicalize || exponent_digits > 6) {
+        memcpy(&result[*result_length], json, i);
+        *result_length += i;
+        return i;
+    }
+
+    // The value is `digits * 10^power`, where `digits` are the significant digits. They are taken from
+    // the integer and fraction digits, which we index as if they were contiguous.
+
+    size_t integer_length = integer_end - integer_start;
+    size_t all_digits_length = integer_length + fraction_end - fraction_start;
+    #define JSON_DIGIT(k) (json[(k) < integer_length ? integer_start + (k) : fraction_start + (k) - integer_length])
+    size_t first_digit = 0, last_digit = all_digits_length;
+    while (first_digit < all_digits_length && JSON_DIGIT(first_digit) == '0') {
+        first_digit += 1;
+    }
+    while (last_digit > first_digit && JSON_DIGIT(last_digit - 1) == '0') {
+        last_digit -= 1;
+    }
+    size_t digits_length = last_digit - first_digit;
+    long power = 0;
+    for (size_t k = exponent_start; k < exponent_end; ++k) {
+        power = power * 10 + (json[k] - '0');
+    }
+    if (json[exponent_start - 1] == '-') {
+        power = -power;
+    }
+    power += (long) (all_digits_length - last_digit) - (long) (fraction_end - fraction_start);
+
+    // Lengths of `1500` or `1500.0`, `15e2` and `1.5e3`
+
+    char exponent[24];
+    size_t sign_length = json[0] == '-';
+    size_t plain_length = sign_length + (digits_length == 0 ? 1 : power >= 0 ? digits_length + power :
+        -power < (long) digits_length ? digits_length + 1 : 2 - power) +
+        (is_float && (digits_length == 0 || power >= 0) ? 2 : 0);
+    size_t integer_mantissa_length = sign_length + digits_length +
+        (power == 0 ? 0 : 1 + snprintf(exponent, sizeof exponent, "%ld", power));
+    long point_power = power + (long) digits_length - 1;
+    size_t point_mantissa_length = sign_length + digits_length + (digits_length > 1) +
+        (point_power == 0 ? 0 : 1 + snprintf(exponent, sizeof exponent, "%ld", point_power));
+    enum {FORM_ORIGINAL, FORM_PLAIN, FORM_INTEGER_MANTISSA, FORM_POINT_MANTISSA} form = FORM_PLAIN;
+    size_t length = plain_length;
+    if (digits_length > 0 && is_float && power != 0 && integer_mantissa_length < length) {
+        form = FORM_INTEGER_MANTISSA;
+        length = integer_mantissa_length;
+    }
+    if (digits_length > 0 && is_float && (digits_length > 1 || point_power != 0) &&
+        point_mantissa_length < length)
+    {
+        form = FORM_POINT_MANTISSA;
+        length = point_mantissa_length;
+    }
+    if (length > i) {
+        form = FORM_ORIGINAL;
+    }
+
+    char *number = &result[*result_length];
+    if (form == FORM_ORIGINAL) {
+        memcpy(number, json, i);
+        *result_length += i;
+        return i;
+    }
+    if (sign_length > 0) {
+        *number++ = '-';
+    }
+    if (digits_length == 0) {
+        *number++ = '0';
+    }
+    else if (form == FORM_PLAIN && power >= 0) {
+        for (size_t k = first_digit; k < last_digit; ++k) {
+            *number++ = JSON_DIGIT(k);
+        }
+        memset(number, '0', power);
+        number += power;
+    }
+    else if (form == FORM_PLAIN && -power < (long) digits_length) {
+        for (size_t k = first_digit; k < last_digit; ++k) {
+            if (k == last_digit + power) {
+                *number++ = '.';
+            }
+            *number++ = JSON_DIGIT(k);
+        }
+    }
+    else if (form == FORM_PLAIN) {
+        *number++ = '0';
+        *number++ = '.';
+        memset(number, '0', -power - digits_length);
+        number += -power - digits_length;
+        for (size_t k = first_digit; k < last_digit; ++k) {
+            *number++ = JSON_DIGIT(k);
+        }
+    }
+    else {
+        for (size_t k = first_digit; k < last_digit; ++k) {
+            *number++ = JSON_DIGIT(k);
+            if (k == first_digit && form == FORM_POINT_MANTISSA && digits_length > 1) {
+                *number++ = '.';
+            }
+        }
+        long exponent_value = form == FORM_POINT_MANTISSA ? point_power : power;
+        if (exponent_value != 0) {
+            number += sprintf(number, "e%ld", exponent_value);
+        }
+    }
+    if (is_float && form == FORM_PLAIN && (digits_length == 0 || power >= 0)) {
+        *number++ = '.';
+        *number++ = '0';
+    }
+    #undef JSON_DIGIT
+    *result_length = number - result;
+    return i;
+}
+
+static struct Minification minify_json_block_into(const char *json, bool canonicalize_numbers, char *result,
+    size_t *result_length_out)
+{
+    struct Minification m = {.result = result};
+
+    size_t bracket_types_capacity = 512;
+    char *bracket_types = malloc(bracket_types_capacity * sizeof *bracket_types);
+
+    if (bracket_types == NULL) {
+        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+        goto error;
+    }
+
+    size_t nesting_level = 0;
+    size_t result_length = 0;
+    size_t i = 0;
+
+    while (true) {
+        while (is_whitespace(json[i])) {
+            i += 1;
+        }
+        if (json[i] == '\0') {
+            m.result[result_length] = '\0';
+            break;
+        }
+        if ((json[i] == ',' || json[i] == '}') && result_length > 0 && m.result[result_length - 1] == ':') {
+            m.error_position = i;
+            snprintf(m.error, sizeof m.error, "No value after `:` in line %%zu, column %%zu\n");
+            goto error;
+        }
+        if (json[i] == '[' || json[i] == '{') {
+            if (++nesting_level > bracket_types_capacity) {
+                bracket_types_capacity *= 2;
+                STATS_ADD(STATS_JSON_BRACKETS_REALLOC, 1);
+                char *bracket_types_realloc = realloc(
+                    bracket_types, bracket_types_capacity * sizeof *bracket_types);
+                if (bracket_types_realloc == NULL) {
+                    snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+                    goto error;
+                }
+                bracket_types = bracket_types_realloc;
+            }
+            bracket_types[nesting_level - 1] = json[i];
+            m.result[result_length++] = json[i];
+            i += 1;
+            continue;
+        }
+        if (json[i] == ']' || json[i] == '}') {
+            if (result_length > 0 && m.result[result_length - 1] == ',') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "Illegal `,` before bracket in line %%zu, column %%zu\n");
+                goto error;
+            }
+            if (nesting_level == 0 || bracket_types[nesting_level - 1] != json[i] - 2) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "Unexpected `%c` in line %%zu, column %%zu\n", json[i]);
+                goto error;
+            }
+            nesting_level -= 1;
+            m.result[result_length++] = json[i];
+            i += 1;
+            continue;
+        }
+
+        bool is_key = nesting_level > 0 && (bracket_types[nesting_level - 1] == '{' &&
             (m.result[result_length - 1] == ',' || m.result[result_length - 1] == '{'));
 
         if (json[i] == '"') {
@@ -644,28 +1410,14 @@ struct Minification minify_json(const char *json)
             i += sizeof "null" - 1;
             continue;
         }
-        if (json[i] >= '0' && json[i] <= '9') {
-            size_t k = i;
-            while (json[k] >= '0' && json[k] <= '9') {
-                k += 1;
-            }
-            if (json[k] == '.') {
-                k += 1;
-            }
-            while (json[k] >= '0' && json[k] <= '9') {
-                k += 1;
-            }
-            if ((json[k] == 'e' || json[k] == 'E') && (json[k + 1] == '+' || json[k + 1] == '-') &&
-                json[k + 2] >= '0' && json[k + 2] <= '9')
-            {
-                k += 2;
-            }
-            while (json[k] >= '0' && json[k] <= '9') {
-                k += 1;
+        if (json[i] >= '0' && json[i] <= '9' || json[i] == '-') {
+            size_t number_length = minify_json_number(&json[i], canonicalize_numbers, m.result, &result_length);
+            if (number_length == 0) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "Invalid number in line %%zu, column %%zu\n");
+                goto error;
             }
-            memcpy(&m.result[result_length], &json[i], k - i);
-            result_length += k - i;
-            i = k;
+            i += number_length;
             continue;
         }
         if (nesting_level > 0 && json[i] == ',' && m.result[result_length - 1] != ',') {
@@ -690,18 +1442,28 @@ struct Minification minify_json(const char *json)
         goto error;
     }
     free(bracket_types);
+    *result_length_out = result_length;
     return m;
 
 error:
     free(bracket_types);
-    free(m.result);
     m.result = NULL;
     return m;
 }
 
-struct Minification minify_js(const char *js)
+static struct Minification minify_json_into(const char *json, char *result, size_t *result_length_out)
+{
+    return minify_json_block_into(json, false, result, result_length_out);
+}
+
+static struct Minification minify_json_canonical_into(const char *json, char *result, size_t *result_length_out)
+{
+    return minify_json_block_into(json, true, result, result_length_out);
+}
+
+static struct Minification minify_js_into(const char *js, char *result, size_t *result_length_out)
 {
-    struct Minification m = {.result = malloc(strlen(js) + 1)};
+    struct Minification m = {.result = result};
 
     size_t curly_blocks_capacity = 64;
     struct CurlyBlock {
@@ -732,7 +1494,7 @@ struct Minification minify_js(const char *js)
         ROUND_BLOCK_PARAM_ARROWFUNC_SINGLE,
     } *round_blocks = malloc(round_blocks_capacity * sizeof *round_blocks);
 
-    if (m.result == NULL || curly_blocks == NULL || round_blocks == NULL) {
+    if (curly_blocks == NULL || round_blocks == NULL) {
         snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
         goto error;
     }
@@ -746,15 +1508,16 @@ struct Minification minify_js(const char *js)
     size_t last_open_curly_bracket_i, last_open_round_bracket_i;
     const char *identifier_delimiters = "'\"`%<>+*/-=,(){}[]!~;|&^:? \t\r\n";
 
-    #define JS_SKIP_WHITESPACES_COMMENTS(js, ptr_i, result, ptr_result_length) \
-        skip_whitespaces_comments(&m, js, ptr_i, result, ptr_result_length, COMMENT_VARIANT_JS); \
-        if (m.error_position != 0) { \
+    #define JS_SKIP_WHITESPACES_COMMENTS(js, ptr_i, min, ptr_min_length) \
+        skip_whitespaces_comments(&m, js, ptr_i, min, ptr_min_length, COMMENT_VARIANT_JS); \
+        if (m.result == NULL) { \
             goto error; \
         }
 
     #define INCR_CURLY_NESTING_LEVEL \
         if (++curly_nesting_level > curly_blocks_capacity) { \
-            curly_blocks_capacity += 512; \
+            curly_blocks_capacity *= 2; \
+            STATS_ADD(STATS_JS_CURLY_BLOCKS_REALLOC, 1); \
             struct CurlyBlock *curly_blocks_realloc = realloc( \
                 curly_blocks, curly_blocks_capacity * sizeof *curly_blocks \
             ); \
@@ -769,7 +1532,8 @@ struct Minification minify_js(const char *js)
 
     #define INCR_ROUND_NESTING_LEVEL \
         if (++round_nesting_level > round_blocks_capacity) { \
-            round_blocks_capacity += 512; \
+            round_blocks_capacity *= 2; \
+            STATS_ADD(STATS_JS_ROUND_BLOCKS_REALLOC, 1); \
             enum RoundBlockType *round_blocks_realloc = realloc( \
                 round_blocks, round_blocks_capacity * sizeof *round_blocks \
             ); \
@@ -788,6 +1552,9 @@ struct Minification minify_js(const char *js)
         }
 
         size_t next_word_length = strcspn(&js[i], identifier_delimiters);
+#ifdef CMINIFY_STATS
+        stats_add_js_keyword(&js[i], next_word_length);
+#endif
         if (next_word_length == 0) {
             goto after_keywords;
         }
@@ -908,7 +1675,9 @@ struct Minification minify_js(const char *js)
                 JS_SKIP_WHITESPACES_COMMENTS(js, &i, m.result, &result_length);
             }
             if (js[i] != '(') {
-                m.result[result_length++] = ' ';
+                if (m.result[result_length - 1] != '*') {
+                    m.result[result_length++] = ' ';
+                }
                 while (strchr(identifier_delimiters, js[i]) == NULL) {
                     m.result[result_length++] = js[i++];
                 }
@@ -1024,6 +1793,9 @@ struct Minification minify_js(const char *js)
 
     after_keywords:
 
+        if (js[i] == '\0') {
+            continue;
+        }
         if (js[i] == '{') {
             INCR_CURLY_NESTING_LEVEL;
             i += 1;
@@ -1118,14 +1890,14 @@ struct Minification minify_js(const char *js)
             continue;
         }
         if (js[i] == ')') {
-            if (round_blocks[round_nesting_level - 1] != ROUND_BLOCK_PARAM_ARROWFUNC_SINGLE) {
-                m.result[result_length++] = ')';
-            }
-            if (round_nesting_level-- == 0) {
+            if (round_nesting_level == 0) {
                 m.error_position = i;
                 snprintf(m.error, sizeof m.error, "Unexpected `)` in line %%zu, column %%zu\n");
                 goto error;
             }
+            if (round_blocks[--round_nesting_level] != ROUND_BLOCK_PARAM_ARROWFUNC_SINGLE) {
+                m.result[result_length++] = ')';
+            }
             i += 1;
             continue;
         }
@@ -1237,6 +2009,7 @@ struct Minification minify_js(const char *js)
                     if (active_backslash) {
                         i += 1;
                         result_length -= 1;
+                        active_backslash = false;
                         continue;
                     }
                     else if (js[quote_i] != '`' && js[quote_i] != '}') {
@@ -1254,7 +2027,7 @@ struct Minification minify_js(const char *js)
                     curly_blocks[curly_nesting_level - 1].type = CURLY_BLOCK_STRING_INTERPOLATION;
                     break;
                 }
-                if (i < quote_i + sizeof "</script" - 1 &&
+                if (i < quote_i + sizeof "</script" - 1 && result_length >= sizeof "</script" - 1 &&
                     !strnicmp(&m.result[result_length - sizeof "</script" + 1], "</script",
                         sizeof "</script" - 1))
                 {
@@ -1423,22 +2196,53 @@ struct Minification minify_js(const char *js)
     }
     free(round_blocks);
     free(curly_blocks);
+    *result_length_out = result_length;
     return m;
 
 error:
     free(round_blocks);
     free(curly_blocks);
-    free(m.result);
     m.result = NULL;
     return m;
 }
 
-static void xmlhtml_correct_error_position(const char *encoded, const char *decoded, size_t *error_position,
-    bool is_xml)
+static struct Minification minify_allocated(const char *input,
+    struct Minification (*minify_into)(const char *, char *, size_t *))
+{
+    char *result = malloc(strlen(input) + 1);
+    if (result == NULL) {
+        struct Minification m = {.result = NULL};
+        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+        return m;
+    }
+    size_t result_length;
+    struct Minification m = minify_into(input, result, &result_length);
+    if (m.result == NULL) {
+        free(result);
+    }
+    return m;
+}
+
+struct Minification minify_css(const char *css)
+{
+    return minify_allocated(css, minify_css_into);
+}
+
+struct Minification minify_json(const char *json)
+{
+    return minify_allocated(json, minify_json_into);
+}
+
+struct Minification minify_js(const char *js)
+{
+    return minify_allocated(js, minify_js_into);
+}
+
+static ALWAYS_INLINE void xmlhtml_correct_error_position(const char *encoded, const char *decoded,
+    size_t *error_position, bool is_xml)
 {
     size_t encoded_i = 0, decoded_i = 0;
     bool in_cdata = false;
-    int (*tagncmp)(const char *, const char *, size_t) = (is_xml ? strncmp : strnicmp);
     while (true) {
         if (*error_position == decoded_i) {
             *error_position = encoded_i;
@@ -1448,44 +2252,44 @@ static void xmlhtml_correct_error_position(const char *encoded, const char *deco
             return;
         }
         if (!in_cdata) {
-            if (is_xml && !tagncmp(&encoded[encoded_i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
+            if (is_xml && !tagncmp(is_xml, &encoded[encoded_i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
                 in_cdata = true;
                 encoded_i += sizeof "<![CDATA[" - 1;
                 decoded_i += 1;
                 continue;
             }
-            if (!tagncmp(&encoded[encoded_i], "&lt;", sizeof "&lt;" - 1)) {
+            if (!tagncmp(is_xml, &encoded[encoded_i], "&lt;", sizeof "&lt;" - 1)) {
                 encoded_i += sizeof "&lt;" - 1;
                 decoded_i += 1;
                 continue;
             }
-            if (!tagncmp(&encoded[encoded_i], "&gt;", sizeof "&gt;" - 1)) {
+            if (!tagncmp(is_xml, &encoded[encoded_i], "&gt;", sizeof "&gt;" - 1)) {
                 encoded_i += sizeof "&gt;" - 1;
                 decoded_i += 1;
                 continue;
             }
-            if (!tagncmp(&encoded[encoded_i], "&amp;", sizeof "&amp;" - 1)) {
+            if (!tagncmp(is_xml, &encoded[encoded_i], "&amp;", sizeof "&amp;" - 1)) {
                 encoded_i += sizeof "&amp;" - 1;
                 decoded_i += 1;
                 continue;
             }
-            if (!tagncmp(&encoded[encoded_i], "&apos;", sizeof "&apos;" - 1)) {
+            if (!tagncmp(is_xml, &encoded[encoded_i], "&apos;", sizeof "&apos;" - 1)) {
                 encoded_i += sizeof "&apos;" - 1;
                 decoded_i += 1;
                 continue;
             }
-            if (!tagncmp(&encoded[encoded_i], "&quot;", sizeof "&quot;" - 1)) {
+            if (!tagncmp(is_xml, &encoded[encoded_i], "&quot;", sizeof "&quot;" - 1)) {
                 encoded_i += sizeof "&quot;" - 1;
                 decoded_i += 1;
                 continue;
             }
             if (!is_xml) {
-                if (!tagncmp(&encoded[encoded_i], "&plus;", sizeof "&plus;" - 1)) {
+                if (!tagncmp(is_xml, &encoded[encoded_i], "&plus;", sizeof "&plus;" - 1)) {
                     encoded_i += sizeof "&quot;" - 1;
                     decoded_i += 1;
                     continue;
                 }
-                if (!tagncmp(&encoded[encoded_i], "&sol;", sizeof "&sol;" - 1)) {
+                if (!tagncmp(is_xml, &encoded[encoded_i], "&sol;", sizeof "&sol;" - 1)) {
                     encoded_i += sizeof "&sol;" - 1;
                     decoded_i += 1;
                     continue;
@@ -1514,7 +2318,14 @@ static void xmlhtml_correct_error_position(const char *encoded, const char *deco
     }
 }
 
-static struct Minification xmlhtml_decode(const char *input, size_t length, bool is_xml)
+// Only XML inline content is decoded before minification, so HTML needs no error position correction
+static void xml_correct_error_position(const char *encoded, const char *decoded, size_t *error_position)
+{
+    xmlhtml_correct_error_position(encoded, decoded, error_position, true);
+}
+
+static ALWAYS_INLINE struct Minification xmlhtml_decode_into(const char *input, size_t length, bool is_xml,
+    char *result, size_t *result_length_out)
 {
     // This function helps minify inline scripts and styles in XML (e.g. SVG, MathML, XHTML)
     // documents. We need to decode XML entities and CDATA sections before feeding the tag content
@@ -1527,12 +2338,7 @@ static struct Minification xmlhtml_decode(const char *input, size_t length, bool
     // The implementation of HTML decoding has only limited capability here, just enough to handle possible
     // encoding of the script type attribute.
 
-    struct Minification m = {.result = malloc(length + 1)};
-    if (m.result == NULL) {
-        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
-        return m;
-    }
-
+    struct Minification m = {.result = result};
     size_t i = 0;
     size_t result_length = 0;
     bool in_cdata = false;
@@ -1671,684 +2477,4036 @@ static struct Minification xmlhtml_decode(const char *input, size_t length, bool
         }
         m.result[result_length++] = input[i++];
     }
-    m.result[result_length++] = '\0';
+    m.result[result_length] = '\0';
+    *result_length_out = result_length;
     return m;
 
 error:
-    free(m.result);
     m.result = NULL;
     return m;
 }
 
-static struct EncodedString
+static struct Minification xml_decode_into(const char *input, size_t length, char *result,
+    size_t *result_length_out)
 {
-    char *data;
-    size_t length;
+    return xmlhtml_decode_into(input, length, true, result, result_length_out);
+}
+
+static struct Minification html_decode_into(const char *input, size_t length, char *result,
+    size_t *result_length_out)
+{
+    return xmlhtml_decode_into(input, length, false, result, result_length_out);
+}
+
+static bool xmlhtml_attribute_equals(const char *value, size_t value_length, const char *expected)
+{
+    // Compares an attribute value to a short ASCII string after decoding entities. Decoding never makes
+    // the value longer, so values that are much longer than the expected string cannot match and are
+    // not decoded at all. This avoids an allocation per attribute.
+
+    char decoded[64];
+    size_t decoded_length;
+    size_t expected_length = strlen(expected);
+    if (value_length < expected_length || value_length >= sizeof decoded) {
+        return false;
+    }
+    if (memchr(value, '&', value_length) == NULL) {
+        return value_length == expected_length && !memcmp(value, expected, expected_length);
+    }
+    return html_decode_into(value, value_length, decoded, &decoded_length).result != NULL &&
+        decoded_length == expected_length && !memcmp(decoded, expected, expected_length);
 }
-xml_encode(const char *input, const size_t input_length)
+
+static size_t xml_encoded_length(const char *input, size_t length, bool *use_cdata)
 {
+    // Inline content is either wrapped in a CDATA section or `<`, `>` and `&` are replaced by
+    // entities, whichever is shorter. A `]]>` inside a CDATA section must be split across two
+    // sections.
+
     size_t added_length_with_cdata = sizeof "<![CDATA[]]>" - 1;
     size_t added_length_with_entities = 0;
-    size_t i = 0;
-    while (true) {
-        if (input[i] == '\0') {
-            break;
-        }
-        else if (input[i] == '<') {
+    for (size_t i = 0; i < length; ++i) {
+        if (input[i] == '<') {
             added_length_with_entities += sizeof "&lt;" - 2;
         }
         else if (input[i] == '>') {
             added_length_with_entities += sizeof "&gt;" - 2;
+            if (i >= 2 && input[i - 1] == ']' && input[i - 2] == ']') {
+                added_length_with_cdata += sizeof "]]]]><![CDATA[>" - sizeof "]]>";
+            }
         }
         else if (input[i] == '&') {
             added_length_with_entities += sizeof "&amp;" - 2;
         }
-        else if (input[i] == ']' && input[i + 1] == ']' && input[i + 2] == '>') {
-            added_length_with_cdata += sizeof "]]><![CDATA[" - 1;
-        }
-        i += 1;
     }
-    if (added_length_with_entities == 0) {
-        struct EncodedString encoded = {
-            malloc(input_length + 1),
-            input_length
-        };
-        if (encoded.data == NULL) {
-            return encoded;
-        }
-        memcpy(encoded.data, input, input_length);
-        encoded.data[input_length] = '\0';
-        return encoded;
-    }
-    if (added_length_with_cdata < added_length_with_entities + 1) {
-        struct EncodedString encoded = {malloc(input_length + added_length_with_cdata + 1), 0};
-        if (encoded.data == NULL) {
-            return encoded;
-        }
-        strcpy(encoded.data, "<![CDATA[");
-        encoded.length = sizeof "<![CDATA[" - 1;
-        for (i = 0; input[i] != '\0'; ++i) {
-            if (!strncmp(&input[i], "]]>", sizeof "]]>" - 1)) {
-                strcpy(&encoded.data[encoded.length], "]]]]><![CDATA[>");
-                encoded.length = sizeof "]]]]><![CDATA[>" - 1;
-                i += 2;
-            }
-            else {
-                encoded.data[encoded.length] = input[i];
-                encoded.length += 1;
-            }
-        }
-        strcpy(&encoded.data[encoded.length], "]]>");
-        encoded.length = sizeof "]]>" - 1;
-        return encoded;
+    *use_cdata = added_length_with_entities > 0 && added_length_with_cdata < added_length_with_entities + 1;
+    return length + (*use_cdata ? added_length_with_cdata : added_length_with_entities);
+}
+
+static void xml_encode_in_place(char *data, size_t length, size_t encoded_length, bool use_cdata)
+{
+    // `data` must have space for `encoded_length` bytes. Encoding runs backwards so that the
+    // expansions never overwrite bytes that have not been read yet.
+
+    size_t result_i = encoded_length;
+    if (use_cdata) {
+        result_i -= sizeof "]]>" - 1;
+        memcpy(&data[result_i], "]]>", sizeof "]]>" - 1);
     }
-    else {
-        struct EncodedString encoded = {malloc(input_length + added_length_with_cdata + 1), 0};
-        if (encoded.data == NULL) {
-            return encoded;
+    for (size_t i = length; i-- > 0;) {
+        if (use_cdata && data[i] == '>' && i >= 2 && data[i - 1] == ']' && data[i - 2] == ']') {
+            result_i -= sizeof "]]]]><![CDATA[>" - 1;
+            memcpy(&data[result_i], "]]]]><![CDATA[>", sizeof "]]]]><![CDATA[>" - 1);
+            i -= 2;
         }
-        encoded.length = 0;
-        for (i = 0; input[i] != '\0'; ++i) {
-            if (input[i] == '<') {
-                strcpy(&encoded.data[encoded.length], "&lt;");
-                encoded.length += sizeof "&lt;" - 1;
-            }
-            else if (input[i] == '>') {
-                strcpy(&encoded.data[encoded.length], "&gt;");
-                encoded.length += sizeof "&gt;" - 1;
-            }
-            else if (input[i] == '&') {
-                strcpy(&encoded.data[encoded.length], "&amp;");
-                encoded.length += sizeof "&amp;" - 1;
-            }
-            else {
-                encoded.data[encoded.length] = input[i];
-                encoded.length += 1;
-            }
+        else if (!use_cdata && data[i] == '<') {
+            result_i -= sizeof "&lt;" - 1;
+            memcpy(&data[result_i], "&lt;", sizeof "&lt;" - 1);
+        }
+        else if (!use_cdata && data[i] == '>') {
+            result_i -= sizeof "&gt;" - 1;
+            memcpy(&data[result_i], "&gt;", sizeof "&gt;" - 1);
         }
-        encoded.data[encoded.length] = '\0';
-        return encoded;
+        else if (!use_cdata && data[i] == '&') {
+            result_i -= sizeof "&amp;" - 1;
+            memcpy(&data[result_i], "&amp;", sizeof "&amp;" - 1);
+        }
+        else {
+            data[--result_i] = data[i];
+        }
+    }
+    if (use_cdata) {
+        memcpy(data, "<![CDATA[", sizeof "<![CDATA[" - 1);
     }
 }
 
-static struct Minification minify_xmlhtml(const char *xmlhtml, bool is_xml)
+// Cache of minified inline blocks
+//
+// Many documents of a site embed the same scripts and stylesheets. The cache maps the content of an
+// inline block and its content type to the minified result and can be shared by all documents of a
+// batch. It is safe to use from several threads. Entries are never evicted; instead, large blocks are
+// not cached and caching stops when the size limit is reached.
+
+#define INLINE_CACHE_MAX_ENTRY_SIZE (1 << 20)
+#define INLINE_CACHE_MAX_SIZE (64 << 20)
+
+struct InlineCache
 {
-    size_t input_strlen = strlen(xmlhtml);
-    struct Minification m = {.result = malloc(input_strlen + 1)};
-    if (m.result == NULL) {
-        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
-        return m;
-    }
+    struct InlineCacheEntry {
+        uint64_t hash;
+        struct Minification (*minify_into)(const char *, char *, size_t *);
+        bool is_xml;
+        char *content;
+        size_t content_length;
+        char *result;
+        size_t result_length;
+    } *entries;
+    size_t capacity;
+    size_t count;
+    size_t size;
+    pthread_mutex_t mutex;
+};
 
-    enum {
-        SYNTAX_BLOCK_TAG,
-        SYNTAX_BLOCK_CONTENT,
-        SYNTAX_BLOCK_DOCTYPE,
-    } syntax_block = SYNTAX_BLOCK_CONTENT;
+static void inline_cache_init(struct InlineCache *cache)
+{
+    *cache = (struct InlineCache) {.entries = NULL};
+    pthread_mutex_init(&cache->mutex, NULL);
+}
 
-    enum {
-        SCRIPT_TYPE_JAVASCRIPT,
-        SCRIPT_TYPE_JSON,
-        SCRIPT_TYPE_OTHER
-    } script_type;
+static void inline_cache_free(struct InlineCache *cache)
+{
+    for (size_t k = 0; k < cache->capacity; ++k) {
+        free(cache->entries[k].content);
+    }
+    free(cache->entries);
+    pthread_mutex_destroy(&cache->mutex);
+}
 
-    size_t i = 0;
-    const char *current_tag;
-    size_t current_tag_length = 0;
-    bool is_closing_tag;
-    bool has_whitespace_before_tag;
-    int (*tagncmp)(const char *, const char *, size_t) = (is_xml ? strncmp : strnicmp);
-    const char *value, *attribute;
-    size_t value_length, attribute_length;
-    size_t result_length = 0;
+static struct InlineCacheEntry *inline_cache_slot(struct InlineCacheEntry *entries, size_t capacity,
+    uint64_t hash, struct Minification (*minify_into)(const char *, char *, size_t *), bool is_xml,
+    const char *content, size_t content_length)
+{
+    // Returns the matching entry or the empty slot where it belongs (linear probing)
 
-    while (true) {
-        // Beginning of inline minification
+    size_t k = hash & (capacity - 1);
+    while (entries[k].content != NULL && !(
+        entries[k].hash == hash && entries[k].minify_into == minify_into && entries[k].is_xml == is_xml &&
+        entries[k].content_length == content_length && !memcmp(entries[k].content, content, content_length)
+    )) {
+        k = (k + 1) & (capacity - 1);
+    }
+    return &entries[k];
+}
 
-        const char *tag_content_delimiter = NULL;
-        struct Minification (*tag_content_minify_callback)(const char *) = NULL;
+static bool inline_cache_get(struct InlineCache *cache, uint64_t hash,
+    struct Minification (*minify_into)(const char *, char *, size_t *), bool is_xml, const char *content,
+    size_t content_length, char **result, size_t *result_capacity, size_t result_position,
+    size_t reserved_capacity, size_t *result_length)
+{
+    // Copies a cached result into `*result` at `result_position`, growing it like `minify_inline_content`
 
-        if (syntax_block == SYNTAX_BLOCK_CONTENT &&
-            current_tag_length == sizeof "script" - 1 &&
-            !tagncmp(current_tag, "script", sizeof "script" - 1))
-        {
-            tag_content_delimiter = "</script";
-            if (script_type == SCRIPT_TYPE_JAVASCRIPT) {
-                tag_content_minify_callback = minify_js;
-            }
-            else if (script_type == SCRIPT_TYPE_JSON) {
-                tag_content_minify_callback = minify_json;
+    bool found = false;
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->count > 0) {
+        struct InlineCacheEntry *entry = inline_cache_slot(cache->entries, cache->capacity, hash, minify_into,
+            is_xml, content, content_length);
+        if (entry->content != NULL) {
+            found = true;
+            if (result_position + entry->result_length + reserved_capacity > *result_capacity) {
+                char *result_realloc = realloc(*result, result_position + entry->result_length + reserved_capacity);
+                found = result_realloc != NULL;
+                if (found) {
+                    *result = result_realloc;
+                    *result_capacity = result_position + entry->result_length + reserved_capacity;
+                }
             }
-            else if (script_type == SCRIPT_TYPE_OTHER) {
-                tag_content_minify_callback = NULL;
+            if (found) {
+                memcpy(&(*result)[result_position], entry->result, entry->result_length);
+                *result_length = entry->result_length;
             }
         }
-        if (syntax_block == SYNTAX_BLOCK_CONTENT &&
-            current_tag_length == sizeof "style" - 1 &&
-            !tagncmp(current_tag, "style", sizeof "style" - 1))
-        {
-            tag_content_delimiter = "</style";
-            tag_content_minify_callback = minify_css;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+static void inline_cache_put(struct InlineCache *cache, uint64_t hash,
+    struct Minification (*minify_into)(const char *, char *, size_t *), bool is_xml, const char *content,
+    size_t content_length, const char *result, size_t result_length)
+{
+    // Failing to cache is not an error, therefore allocation failures are ignored
+
+    if (content_length > INLINE_CACHE_MAX_ENTRY_SIZE) {
+        return;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->size + content_length + result_length > INLINE_CACHE_MAX_SIZE) {
+        goto unlock;
+    }
+    if (2 * (cache->count + 1) > cache->capacity) {
+        size_t capacity = cache->capacity == 0 ? 64 : 2 * cache->capacity;
+        struct InlineCacheEntry *entries = calloc(capacity, sizeof *entries);
+        if (entries == NULL) {
+            goto unlock;
         }
-        if (tag_content_delimiter != NULL) {
-            size_t content_start_i = i;
-            bool in_cdata = false;
-            while (true) {
-                if (xmlhtml[i] == '\0') {
-                    do {
-                        i -= 1;
-                    } while (is_whitespace(xmlhtml[i - 1]));
-                    m.error_position = i - 1;
-                    snprintf(m.error, sizeof m.error,
-                        "Unexpected end of document, expected `%s>` after line %%zu, column %%zu\n",
-                        tag_content_delimiter);
-                    goto error;
-                }
-                if (is_xml &&
-                    !strncmp(&xmlhtml[i], "<![CDATA[", sizeof "<![CDATA[" - 1))
-                {
-                    in_cdata = true;
-                    i += sizeof "<![CDATA[" - 1;
-                    continue;
-                }
-                if (is_xml &&
-                    !strncmp(&xmlhtml[i], "]]>", sizeof "]]>" - 1))
-                {
-                    in_cdata = false;
-                    i += sizeof "]]>" - 1;
-                    continue;
-                }
-                if (!in_cdata &&
-                    !tagncmp(&xmlhtml[i], tag_content_delimiter, sizeof tag_content_delimiter - 1))
-                {
-                    current_tag_length = 0;
-                    break;
-                }
-                i += 1;
-            }
-            if (tag_content_minify_callback == NULL) {
-                memcpy(&m.result[result_length], &xmlhtml[content_start_i], i - content_start_i);
-                result_length += i - content_start_i;
-                continue;
-            }
-
-            struct Minification inline_m;
-            if (is_xml) {
-                inline_m = xmlhtml_decode(&xmlhtml[content_start_i], i - content_start_i, true);
-                if (inline_m.result == NULL) {
-                    inline_m.error_position += content_start_i;
-                    goto error;
-                }
-                char *input_to_free = inline_m.result;
-                inline_m = tag_content_minify_callback(inline_m.result);
-                free(input_to_free);
-                if (inline_m.result == NULL) {
-                    xmlhtml_correct_error_position(&xmlhtml[content_start_i], inline_m.result,
-                        &m.error_position, is_xml);
-                    inline_m.error_position += content_start_i;
-                    goto error;
-                }
-                struct EncodedString encoded = xml_encode(inline_m.result, i - content_start_i);
-                free(inline_m.result);
-                if (encoded.data == NULL) {
-                    inline_m.result = NULL;
-                    goto error;
-                }
-                inline_m.result = encoded.data;
-                if (encoded.length > i - content_start_i) {
-                    char *result_realloc = realloc(
-                        inline_m.result, input_strlen + encoded.length - i + content_start_i
-                    );
-                    if (result_realloc == NULL) {
-                        goto error;
-                    }
-                    inline_m.result = result_realloc;
-                }
-            }
-            else {
-                char *tag_content = malloc(i - content_start_i + 1);
-                if (tag_content == NULL) {
-                    goto error;
-                }
-                memcpy(tag_content, &xmlhtml[content_start_i], i - content_start_i);
-                tag_content[i - content_start_i] = '\0';
-                inline_m = tag_content_minify_callback(tag_content);
-                free(tag_content);
-                if (inline_m.result == NULL) {
-                    inline_m.error_position += content_start_i;
-                    goto error;
-                }
+        for (size_t k = 0; k < cache->capacity; ++k) {
+            if (cache->entries[k].content != NULL) {
+                *inline_cache_slot(entries, capacity, cache->entries[k].hash, NULL, false, NULL, 0) =
+                    cache->entries[k];
             }
-            size_t inline_result_length = strlen(inline_m.result);
-            memcpy(&m.result[result_length], inline_m.result, inline_result_length);
-            result_length += inline_result_length;
-            free(inline_m.result);
-            continue;
         }
+        free(cache->entries);
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    struct InlineCacheEntry *entry = inline_cache_slot(cache->entries, cache->capacity, hash, minify_into,
+        is_xml, content, content_length);
+    if (entry->content != NULL) {
+        // Another thread has cached the same block in the meantime
+        goto unlock;
+    }
+    char *data = malloc(content_length + result_length);
+    if (data == NULL) {
+        goto unlock;
+    }
+    memcpy(data, content, content_length);
+    memcpy(&data[content_length], result, result_length);
+    *entry = (struct InlineCacheEntry) {
+        .hash = hash,
+        .minify_into = minify_into,
+        .is_xml = is_xml,
+        .content = data,
+        .content_length = content_length,
+        .result = &data[content_length],
+        .result_length = result_length,
+    };
+    cache->count += 1;
+    cache->size += content_length + result_length;
 
-        // End of inline minification
+unlock:
+    pthread_mutex_unlock(&cache->mutex);
+}
 
-        if (xmlhtml[i] == '\0') {
-            if (syntax_block == SYNTAX_BLOCK_TAG) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error,
-                    "Unexpected end of document expected `>` after line %%zu, column %%zu\n");
-                goto error;
-            }
-            m.result[result_length] = '\0';
+// Asset manifest
+//
+// Batch mode can name each output after a hash of its content, such that it can be cached forever.
+// The manifest maps the paths of the outputs relative to the output directory to their hashed paths.
+// These are the paths of the inputs relative to the root directory, so batches of stylesheets and of
+// documents that are minified separately with the same root agree on them.
+// HTML documents minified with a manifest get relative `src` and `href` references rewritten that
+// resolve to a path in the manifest. Root-relative and external URLs are left as they are, because the
+// manifest does not know where the output directory is served.
+
+struct ManifestEntry
+{
+    uint64_t hash;
+    char *name;
+    char *hashed_name;
+};
+
+struct Manifest
+{
+    // Entries in insertion order, which is the order of the manifest file
+    struct ManifestEntry *entries;
+    size_t count;
+    size_t capacity;
+
+    // Hash table of entry indices plus 1, where 0 marks an empty slot
+    size_t *slots;
+    size_t slot_capacity;
+};
+
+static size_t *manifest_slot(const struct Manifest *manifest, uint64_t hash, const char *name, size_t name_length)
+{
+    // Returns the slot of the matching entry or the empty slot where it belongs (linear probing)
+
+    size_t k = hash & (manifest->slot_capacity - 1);
+    while (manifest->slots[k] != 0) {
+        const struct ManifestEntry *entry = &manifest->entries[manifest->slots[k] - 1];
+        if (entry->hash == hash && !strncmp(entry->name, name, name_length) && entry->name[name_length] == '\0') {
             break;
         }
-        if (!strncmp(&xmlhtml[i], "<!--", 4)) {
-            size_t comment_start_i = i;
-            i += 4;
-            while (xmlhtml[i] != '\0' && strncmp(&xmlhtml[i], "-->", 3)) {
-                i += 1;
-            }
-            if (xmlhtml[i] == '\0') {
-                m.error_position = comment_start_i;
-                snprintf(m.error, sizeof m.error, "Unclosed comment starting in line %%zu, column %%zu\n");
-                goto error;
-            }
-            i += 3;
+        k = (k + 1) & (manifest->slot_capacity - 1);
+    }
+    return &manifest->slots[k];
+}
 
-            // Trim whitespace at the end of the document
+static const char *manifest_lookup(const struct Manifest *manifest, const char *name, size_t name_length)
+{
+    if (manifest->count == 0) {
+        return NULL;
+    }
+    size_t slot = *manifest_slot(manifest, hash_bytes(name, name_length), name, name_length);
+    return slot == 0 ? NULL : manifest->entries[slot - 1].hashed_name;
+}
 
-            size_t k = i;
-            while (is_whitespace(xmlhtml[k])) {
-                k += 1;
-            }
-            if (xmlhtml[k] == '\0') {
-                i = k;
+static const char *manifest_lookup_reference(const struct Manifest *manifest, const char *document_path,
+    const char *reference, size_t reference_length)
+{
+    // Resolves a relative reference like `../css/app.css` against the directory of the document and
+    // returns the hashed file name, without directories, of the resolved path, or NULL
+
+    bool has_scheme = reference_length > 0 && isalpha((unsigned char) reference[0]);
+    for (size_t k = 1; has_scheme && k < reference_length && reference[k] != ':'; ++k) {
+        has_scheme = isalnum((unsigned char) reference[k]) || strchr("+-.", reference[k]) != NULL;
+    }
+    has_scheme = has_scheme && memchr(reference, ':', reference_length) != NULL;
+    if (reference_length == 0 || reference[0] == '/' || has_scheme) {
+        return NULL;
+    }
+
+    char path[4096];
+    const char *document_name = strrchr(document_path, '/');
+    size_t path_length = document_name == NULL ? 0 : (size_t) (document_name + 1 - document_path);
+    if (path_length + reference_length > sizeof path) {
+        return NULL;
+    }
+    memcpy(path, document_path, path_length);
+    const char *segment = reference;
+    const char *reference_end = &reference[reference_length];
+    while (true) {
+        const char *segment_end = memchr(segment, '/', reference_end - segment);
+        segment_end = segment_end == NULL ? reference_end : segment_end;
+        size_t segment_length = segment_end - segment;
+        bool is_last = segment_end == reference_end;
+        if (segment_length == sizeof "." - 1 && segment[0] == '.' ||
+            segment_length == sizeof ".." - 1 && !strncmp(segment, "..", segment_length))
+        {
+            if (is_last) {
+                // A directory
+                return NULL;
             }
-            continue;
-        }
-        if (is_xml && !strncmp(&xmlhtml[i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
-            memcpy(&m.result[result_length], "<![CDATA[", sizeof "<![CDATA[" - 1);
-            result_length += sizeof "<![CDATA[" - 1;
-            i += sizeof "<![CDATA[" - 1;
-            while (true) {
-                if (!strncmp(&xmlhtml[i], "]]>", sizeof "]]>" - 1)) {
-                    memcpy(&m.result[result_length], "]]>", sizeof "]]>" - 1);
-                    result_length += sizeof "]]>" - 1;
-                    i += sizeof "]]>" - 1;
-                    break;
+            if (segment_length == sizeof ".." - 1) {
+                if (path_length == 0) {
+                    return NULL;
                 }
-                m.result[result_length++] = xmlhtml[i];
-                i += 1;
+                do {
+                    path_length -= 1;
+                } while (path_length > 0 && path[path_length - 1] != '/');
             }
-            continue;
         }
-        if (xmlhtml[i] == '<') {
-            // Consume `<` and tag name
-            if (syntax_block == SYNTAX_BLOCK_TAG) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "Illegal `<` in line %%zu, column %%zu\n");
-                goto error;
-            }
-            has_whitespace_before_tag =
-                result_length > 0 && is_whitespace(m.result[result_length - 1]);
-            m.result[result_length++] = '<';
-            i += 1;
-            if (!strnicmp(&xmlhtml[i], "!DOCTYPE", sizeof "!DOCTYPE" - 1)) {
-                syntax_block = SYNTAX_BLOCK_DOCTYPE;
-                continue;
-            }
+        else {
+            memcpy(&path[path_length], segment, segment_length + !is_last);
+            path_length += segment_length + !is_last;
+        }
+        if (is_last) {
+            break;
+        }
+        segment = segment_end + 1;
+    }
+    const char *hashed_name = manifest_lookup(manifest, path, path_length);
+    if (hashed_name == NULL) {
+        return NULL;
+    }
+    const char *hashed_file_name = strrchr(hashed_name, '/');
+    return hashed_file_name == NULL ? hashed_name : hashed_file_name + 1;
+}
 
-            current_tag = &xmlhtml[i];
-            is_closing_tag = (xmlhtml[i] == '/');
-            if (is_closing_tag) {
-                m.result[result_length++] = '/';
-                i += 1;
-            }
-            if (!(
-                xmlhtml[i] >= 'a' && xmlhtml[i] <= 'z' ||
-                xmlhtml[i] >= 'A' && xmlhtml[i] <= 'Z' ||
-                xmlhtml[i] == ':' || xmlhtml[i] == '_' ||
-                xmlhtml[i] == '?'
-            )) {
-                m.error_position = i - 1;
-                snprintf(m.error, sizeof m.error,
-                    "`%c` in line %%zu, column %%zu is followed by an illegal character\n", xmlhtml[i - 1]);
-                goto error;
-            }
-            m.result[result_length++] = xmlhtml[i];
-            current_tag_length = 1;
-            while (
-                xmlhtml[i + current_tag_length] >= 'a' && xmlhtml[i + current_tag_length] <= 'z' ||
-                xmlhtml[i + current_tag_length] >= 'A' && xmlhtml[i + current_tag_length] <= 'Z' ||
-                xmlhtml[i + current_tag_length] >= '0' && xmlhtml[i + current_tag_length] <= '9' ||
-                xmlhtml[i + current_tag_length] == '-'
-            ) {
-                current_tag_length += 1;
-                m.result[result_length++] = xmlhtml[i + current_tag_length - 1];
-            }
-            if (
-                xmlhtml[i + current_tag_length] != '/' && xmlhtml[i + current_tag_length] != '>' &&
-                !is_whitespace(xmlhtml[i + current_tag_length])
-            ) {
-                m.error_position = i + current_tag_length;
-                snprintf(m.error, sizeof m.error,
-                    "Illegal character in tag name in in line %%zu, column %%zu\n");
-                goto error;
-            }
-            syntax_block = SYNTAX_BLOCK_TAG;
-            script_type = SCRIPT_TYPE_JAVASCRIPT;
-            attribute_length = 0;
-            i += current_tag_length;
-            continue;
+static bool manifest_set(struct Manifest *manifest, const char *name, size_t name_length, const char *hashed_name,
+    size_t hashed_name_length)
+{
+    // Adds or replaces an entry. Returns false if out of memory.
+
+    if (2 * (manifest->count + 1) > manifest->slot_capacity) {
+        size_t slot_capacity = manifest->slot_capacity == 0 ? 128 : 2 * manifest->slot_capacity;
+        size_t *slots = calloc(slot_capacity, sizeof *slots);
+        if (slots == NULL) {
+            return false;
         }
-        if (xmlhtml[i] == '>') {
-            if (syntax_block == SYNTAX_BLOCK_CONTENT) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "Illegal `>` in line %%zu, column %%zu\n");
-                goto error;
-            }
-            if (xmlhtml[i - 1] == '/' && m.result[result_length - 1] != '=') {
-                is_closing_tag = true;
+        for (size_t j = 0; j < manifest->count; ++j) {
+            size_t k = manifest->entries[j].hash & (slot_capacity - 1);
+            while (slots[k] != 0) {
+                k = (k + 1) & (slot_capacity - 1);
             }
+            slots[k] = j + 1;
+        }
+        free(manifest->slots);
+        manifest->slots = slots;
+        manifest->slot_capacity = slot_capacity;
+    }
 
-            // Transform `<xmlhtml></xmlhtml>` to `<xmlhtml/>`. This would be illegal for HTML.
+    char *entry_name = malloc(name_length + 1 + hashed_name_length + 1);
+    if (entry_name == NULL) {
+        return false;
+    }
+    memcpy(entry_name, name, name_length);
+    entry_name[name_length] = '\0';
+    char *entry_hashed_name = &entry_name[name_length + 1];
+    memcpy(entry_hashed_name, hashed_name, hashed_name_length);
+    entry_hashed_name[hashed_name_length] = '\0';
+    uint64_t hash = hash_bytes(name, name_length);
 
-            else if (is_xml &&
-                     syntax_block != SYNTAX_BLOCK_DOCTYPE &&
-                     xmlhtml[i + 1] == '<' && xmlhtml[i + 2] == '/' &&
-                     !strncmp(current_tag, &xmlhtml[i + 3], current_tag_length) &&
-                     (is_whitespace(xmlhtml[i + 3 + current_tag_length]) ||
-                     xmlhtml[i + 3 + current_tag_length] == '>'))
-            {
-                m.result[result_length++] = '/';
-                m.result[result_length++] = '>';
-                i += 3 + current_tag_length;
-                while (xmlhtml[i] != '>' && xmlhtml[i] != '\0') {
-                    i += 1;
-                }
-                syntax_block = SYNTAX_BLOCK_CONTENT;
-                current_tag_length = 0;
-                i += 1;
-                continue;
-            }
+    size_t *slot = manifest_slot(manifest, hash, name, name_length);
+    if (*slot != 0) {
+        struct ManifestEntry *entry = &manifest->entries[*slot - 1];
+        free(entry->name);
+        *entry = (struct ManifestEntry) {.hash = hash, .name = entry_name, .hashed_name = entry_hashed_name};
+        return true;
+    }
+    if (manifest->count == manifest->capacity) {
+        size_t capacity = manifest->capacity == 0 ? 64 : 2 * manifest->capacity;
+        struct ManifestEntry *entries_realloc = realloc(manifest->entries, capacity * sizeof *entries_realloc);
+        if (entries_realloc == NULL) {
+            free(entry_name);
+            return false;
+        }
+        manifest->entries = entries_realloc;
+        manifest->capacity = capacity;
+    }
+    manifest->entries[manifest->count++] =
+        (struct ManifestEntry) {.hash = hash, .name = entry_name, .hashed_name = entry_hashed_name};
+    *slot = manifest->count;
+    return true;
+}
 
-            i += 1;
-            syntax_block = SYNTAX_BLOCK_CONTENT;
+static void manifest_free(struct Manifest *manifest)
+{
+    for (size_t k = 0; k < manifest->count; ++k) {
+        free(manifest->entries[k].name);
+    }
+    free(manifest->entries);
+    free(manifest->slots);
+}
 
-            if (is_xml) {
-                // Ignore whitespace except between opening and closing tags
+// Tracing
+//
+// With --trace, the time spent and the bytes read and written in each phase are recorded per file. The
+// inline phases are part of the minify phase. Inline blocks of large documents are minified by several
+// threads, so their times are summed over the threads.
 
-                size_t k = i;
-                while (is_whitespace(xmlhtml[k])) {
-                    k += 1;
-                }
-                if (xmlhtml[k] == '<' && (is_closing_tag || xmlhtml[k + 1] != '/')) {
-                    i = k;
-                }
-            }
+enum TracePhase
+{
+    TRACE_READ, TRACE_MINIFY, TRACE_INLINE_JS, TRACE_INLINE_CSS, TRACE_INLINE_JSON, TRACE_INLINE_CACHE_HIT,
+    TRACE_STYLE_ATTRIBUTE, TRACE_EVENT_HANDLER, TRACE_XML_DECODE, TRACE_XML_ENCODE, TRACE_ERROR_POSITION,
+    TRACE_COMPRESS, TRACE_WRITE, TRACE_PHASE_COUNT
+};
 
-            m.result[result_length++] = '>';
+static const char *const trace_phase_names[TRACE_PHASE_COUNT] = {
+    "read", "minify", "inline_js", "inline_css", "inline_json", "inline_cache_hit", "style_attribute",
+    "event_handler", "xml_decode", "xml_encode", "error_position", "compress", "write"
+};
 
-            // Trim whitespace at the end of the document
+struct TracePhaseStats
+{
+    size_t count;
+    double seconds;
+    size_t bytes_in;
+    size_t bytes_out;
+};
 
-            size_t k = i;
-            while (is_whitespace(xmlhtml[k])) {
-                k += 1;
-            }
-            if (xmlhtml[k] == '\0') {
-                i = k;
-            }
-            continue;
-        }
-        if (syntax_block == SYNTAX_BLOCK_TAG && is_whitespace(xmlhtml[i])) {
+struct Trace
+{
+    struct TracePhaseStats phases[TRACE_PHASE_COUNT];
+    pthread_mutex_t mutex;
+};
+
+static double now_seconds(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void trace_init(struct Trace *trace)
+{
+    memset(trace->phases, 0, sizeof trace->phases);
+    pthread_mutex_init(&trace->mutex, NULL);
+}
+
+static void trace_free(struct Trace *trace)
+{
+    pthread_mutex_destroy(&trace->mutex);
+}
+
+static double trace_start(const struct Trace *trace)
+{
+    // Without tracing, the clock is not read
+    return trace == NULL ? 0 : now_seconds();
+}
+
+static void trace_end(struct Trace *trace, enum TracePhase phase, double start, size_t bytes_in,
+    size_t bytes_out)
+{
+    if (trace == NULL) {
+        return;
+    }
+    double seconds = now_seconds() - start;
+    pthread_mutex_lock(&trace->mutex);
+    trace->phases[phase].count += 1;
+    trace->phases[phase].seconds += seconds;
+    trace->phases[phase].bytes_in += bytes_in;
+    trace->phases[phase].bytes_out += bytes_out;
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+static enum TracePhase trace_inline_phase(struct Minification (*minify_into)(const char *, char *, size_t *))
+{
+    if (minify_into == minify_js_into) {
+        return TRACE_INLINE_JS;
+    }
+    return minify_into == minify_css_into ? TRACE_INLINE_CSS : TRACE_INLINE_JSON;
+}
+
+struct MinifyOptions
+{
+    // Threads for minifying the inline scripts and styles of large XML and HTML documents. 0 means one
+    // thread per online processor, which only the command line interface uses by default, so that the
+    // library does not start threads unless asked to.
+    unsigned threads;
+
+    // Shared cache of minified inline blocks, or NULL
+    struct InlineCache *cache;
+
+    // Omit HTML tags and whitespace that the HTML specification allows to omit without changing the
+    // rendering, for example `</li>` before `<li>`
+    bool omit_optional_tags;
+
+    // Write JSON numbers in their shortest form, for example `1.5` instead of `1.50`
+    bool canonicalize_json_numbers;
+
+    // Hashed asset names to refer to in HTML documents, or NULL
+    const struct Manifest *manifest;
+
+    // Path of the document relative to the output directory, to resolve references with the manifest
+    const char *document_path;
+
+    // Timings of the phases of the current file, or NULL
+    struct Trace *trace;
+};
+
+static const struct MinifyOptions default_options = {
+    .threads = 1, .cache = NULL, .omit_optional_tags = false, .canonicalize_json_numbers = false, .manifest = NULL,
+    .document_path = NULL, .trace = NULL
+};
+
+// Documents smaller than this are not worth starting threads for. The fuzzers lower it to reach the
+// parallel code with small inputs.
+#ifndef INLINE_PARALLEL_MIN_SIZE
+#define INLINE_PARALLEL_MIN_SIZE 65536
+#endif
+
+static unsigned online_processors(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors > 0) {
+        return processors;
+    }
+#endif
+    return 1;
+}
+
+static bool html_attribute_needs_quotes(const char *value, size_t length)
+{
+    // See https://html.spec.whatwg.org/#unquoted
+
+    if (length == 0) {
+        return true;
+    }
+    for (size_t k = 0; k < length; ++k) {
+        if (strchr(" \r\t\n=\"'/<>`", value[k]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool html_attribute_is_decodable(const char *value, size_t length)
+{
+    // `xmlhtml_decode_into` knows only a few named HTML entities. Values with other named entities
+    // such as `&nbsp;` cannot be minified.
+
+    static const char *const entities[] = {"&lt;", "&gt;", "&amp;", "&apos;", "&quot;", "&plus;", "&sol;", "&#"};
+
+    for (const char *c = memchr(value, '&', length); c != NULL; c = memchr(c + 1, '&', &value[length] - c - 1)) {
+        if (c + 1 == &value[length] || !isalnum((unsigned char) c[1]) && c[1] != '#') {
+            continue;
+        }
+        bool is_known = false;
+        for (size_t k = 0; k < sizeof entities / sizeof *entities && !is_known; ++k) {
+            size_t entity_length = strlen(entities[k]);
+            is_known = entity_length <= (size_t) (&value[length] - c) && !memcmp(c, entities[k], entity_length);
+        }
+        if (!is_known) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct Minification minify_html_attribute(const char *value, size_t value_length,
+    struct Minification (*minify_into)(const char *, char *, size_t *), char **scratch,
+    size_t *scratch_capacity, char *result, size_t available_length, size_t *result_length_out)
+{
+    // Minifies the value of a `style` or event handler attribute and writes it including the quotes, if
+    // any, to `result`. Sets the length to 0 without writing anything if the value contains entities
+    // that cannot be decoded, if it is not valid CSS or JavaScript, or if the minified value would not
+    // fit into `available_length` bytes. Invalid code is kept as it is rather than reported, because
+    // attribute values are often template placeholders like `{{x}}` that are only filled in later.
+
+    struct Minification m = {.result = result};
+    *result_length_out = 0;
+    if (!html_attribute_is_decodable(value, value_length)) {
+        return m;
+    }
+    size_t needed_capacity = 2 * (value_length + 1) + value_length / 8;
+    if (needed_capacity > *scratch_capacity) {
+        char *scratch_realloc = realloc(*scratch, needed_capacity);
+        if (scratch_realloc == NULL) {
+            m.result = NULL;
+            snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+            return m;
+        }
+        *scratch = scratch_realloc;
+        *scratch_capacity = needed_capacity;
+    }
+    char *decoded = *scratch;
+    char *minified = &(*scratch)[value_length + 1];
+    size_t decoded_length, minified_length;
+    if (html_decode_into(value, value_length, decoded, &decoded_length).result == NULL ||
+        memchr(decoded, '\0', decoded_length) != NULL)
+    {
+        return m;
+    }
+    if (minify_into(decoded, minified, &minified_length).result == NULL) {
+        return m;
+    }
+
+    // An ampersand must only be encoded when it could start a character reference. Quotes are encoded
+    // as `&quot;` or `&#39;`, whichever makes the value shorter.
+
+    size_t ampersands = 0, double_quotes = 0, single_quotes = 0;
+    for (size_t k = 0; k < minified_length; ++k) {
+        ampersands += minified[k] == '&' && (isalnum((unsigned char) minified[k + 1]) || minified[k + 1] == '#');
+        double_quotes += minified[k] == '"';
+        single_quotes += minified[k] == '\'';
+    }
+    char quote = '\0';
+    size_t encoded_length = minified_length + 4 * ampersands;
+    if (html_attribute_needs_quotes(minified, minified_length)) {
+        quote = 5 * double_quotes <= 4 * single_quotes ? '"' : '\'';
+        encoded_length += 2 + (quote == '"' ? 5 * double_quotes : 4 * single_quotes);
+    }
+    if (encoded_length > available_length) {
+        return m;
+    }
+
+    size_t result_length = 0;
+    if (quote != '\0') {
+        result[result_length++] = quote;
+    }
+    for (size_t k = 0; k < minified_length; ++k) {
+        if (minified[k] == '&' && (isalnum((unsigned char) minified[k + 1]) || minified[k + 1] == '#')) {
+            memcpy(&result[result_length], "&amp;", sizeof "&amp;" - 1);
+            result_length += sizeof "&amp;" - 1;
+        }
+        else if (minified[k] == '"' && quote == '"') {
+            memcpy(&result[result_length], "&quot;", sizeof "&quot;" - 1);
+            result_length += sizeof "&quot;" - 1;
+        }
+        else if (minified[k] == '\'' && quote == '\'') {
+            memcpy(&result[result_length], "&#39;", sizeof "&#39;" - 1);
+            result_length += sizeof "&#39;" - 1;
+        }
+        else {
+            result[result_length++] = minified[k];
+        }
+    }
+    if (quote != '\0') {
+        result[result_length++] = quote;
+    }
+    *result_length_out = result_length;
+    return m;
+}
+
+static struct Minification minify_inline_content(const char *content, size_t content_length, bool is_xml,
+    struct Minification (*minify_into)(const char *, char *, size_t *), struct InlineCache *cache,
+    struct Trace *trace, char **scratch, size_t *scratch_capacity, char **result, size_t *result_capacity,
+    size_t result_position, size_t reserved_capacity, size_t *inline_result_length)
+{
+    // Minifies inline script or style content into `*result` at `result_position` and grows `*result`
+    // such that `reserved_capacity` bytes remain after the minified content. The minifiers need a
+    // terminated input, so the content is copied into `*scratch`, which is reused for all inline
+    // blocks. In XML, entities and CDATA sections are decoded on the way. Minified content is never
+    // longer than its source; only encoding it again for XML may need more space. The error position
+    // is relative to `content`.
+
+    struct Minification m = {.result = NULL};
+    double start = trace_start(trace);
+    uint64_t hash;
+    if (cache != NULL) {
+        hash = hash_bytes(content, content_length);
+        if (inline_cache_get(cache, hash, minify_into, is_xml, content, content_length, result, result_capacity,
+            result_position, reserved_capacity, inline_result_length))
+        {
+            trace_end(trace, TRACE_INLINE_CACHE_HIT, start, content_length, *inline_result_length);
+            trace_end(trace, trace_inline_phase(minify_into), start, content_length, *inline_result_length);
+            m.result = *result;
+            return m;
+        }
+    }
+    if (content_length + 1 > *scratch_capacity) {
+        char *scratch_realloc = realloc(*scratch, content_length + 1);
+        if (scratch_realloc == NULL) {
+            snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+            return m;
+        }
+        *scratch = scratch_realloc;
+        *scratch_capacity = content_length + 1;
+    }
+    if (result_position + content_length + reserved_capacity > *result_capacity) {
+        char *result_realloc = realloc(*result, result_position + content_length + reserved_capacity);
+        if (result_realloc == NULL) {
+            snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+            return m;
+        }
+        *result = result_realloc;
+        *result_capacity = result_position + content_length + reserved_capacity;
+    }
+    if (is_xml) {
+        double decode_start = trace_start(trace);
+        size_t decoded_length;
+        m = xml_decode_into(content, content_length, *scratch, &decoded_length);
+        if (m.result == NULL) {
+            return m;
+        }
+        trace_end(trace, TRACE_XML_DECODE, decode_start, content_length, decoded_length);
+    }
+    else {
+        memcpy(*scratch, content, content_length);
+        (*scratch)[content_length] = '\0';
+    }
+    m = minify_into(*scratch, &(*result)[result_position], inline_result_length);
+    if (m.result == NULL) {
+        if (is_xml) {
+            double error_start = trace_start(trace);
+            xml_correct_error_position(content, *scratch, &m.error_position);
+            trace_end(trace, TRACE_ERROR_POSITION, error_start, content_length, 0);
+        }
+        return m;
+    }
+    if (is_xml) {
+        double encode_start = trace_start(trace);
+        bool use_cdata;
+        size_t encoded_length = xml_encoded_length(&(*result)[result_position], *inline_result_length,
+            &use_cdata);
+        if (result_position + encoded_length + reserved_capacity > *result_capacity) {
+            char *result_realloc = realloc(*result, result_position + encoded_length + reserved_capacity);
+            if (result_realloc == NULL) {
+                m.result = NULL;
+                snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+                return m;
+            }
+            *result = result_realloc;
+            *result_capacity = result_position + encoded_length + reserved_capacity;
+        }
+        xml_encode_in_place(&(*result)[result_position], *inline_result_length, encoded_length, use_cdata);
+        trace_end(trace, TRACE_XML_ENCODE, encode_start, *inline_result_length, encoded_length);
+        *inline_result_length = encoded_length;
+    }
+    if (cache != NULL) {
+        inline_cache_put(cache, hash, minify_into, is_xml, content, content_length, &(*result)[result_position],
+            *inline_result_length);
+    }
+    trace_end(trace, trace_inline_phase(minify_into), start, content_length, *inline_result_length);
+    m.result = *result;
+    return m;
+}
+
+// Parallel minification of inline blocks
+//
+// In large documents, the inline blocks are collected as jobs while the markup is minified. They are
+// minified by a pool of threads afterwards and their results are spliced into the markup in document
+// order.
+
+struct InlineJob
+{
+    size_t content_start;
+    size_t content_length;
+    size_t result_position;
+    struct Minification (*minify_into)(const char *, char *, size_t *);
+    char *result;
+    size_t result_length;
+    struct Minification m;
+};
+
+struct InlineJobQueue
+{
+    const char *xmlhtml;
+    bool is_xml;
+    struct InlineCache *cache;
+    struct Trace *trace;
+    struct InlineJob *jobs;
+    size_t job_count;
+    size_t next_job;
+    pthread_mutex_t mutex;
+};
+
+static void *inline_job_worker(void *queue_pointer)
+{
+    struct InlineJobQueue *queue = queue_pointer;
+    char *scratch = NULL;
+    size_t scratch_capacity = 0;
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        size_t job_i = queue->next_job++;
+        pthread_mutex_unlock(&queue->mutex);
+        if (job_i >= queue->job_count) {
+            break;
+        }
+        struct InlineJob *job = &queue->jobs[job_i];
+        size_t result_capacity = 0;
+        job->m = minify_inline_content(&queue->xmlhtml[job->content_start], job->content_length,
+            queue->is_xml, job->minify_into, queue->cache, queue->trace, &scratch, &scratch_capacity,
+            &job->result, &result_capacity, 0, 1, &job->result_length);
+        if (job->m.result == NULL) {
+            job->m.error_position += job->content_start;
+        }
+    }
+    free(scratch);
+    return NULL;
+}
+
+static void run_inline_jobs(const char *xmlhtml, bool is_xml, struct InlineCache *cache, struct Trace *trace,
+    struct InlineJob *jobs, size_t job_count, unsigned threads)
+{
+    struct InlineJobQueue queue = {
+        .xmlhtml = xmlhtml, .is_xml = is_xml, .cache = cache, .trace = trace, .jobs = jobs, .job_count = job_count
+    };
+    pthread_mutex_init(&queue.mutex, NULL);
+
+    // The calling thread is one of the workers
+
+    size_t worker_count = threads - 1 < job_count - 1 ? threads - 1 : job_count - 1;
+    pthread_t *workers = malloc(worker_count * sizeof *workers);
+    if (workers == NULL) {
+        worker_count = 0;
+    }
+    size_t started = 0;
+    while (started < worker_count && !pthread_create(&workers[started], NULL, inline_job_worker, &queue)) {
+        started += 1;
+    }
+    inline_job_worker(&queue);
+    for (size_t k = 0; k < started; ++k) {
+        pthread_join(workers[k], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&queue.mutex);
+}
+
+static bool splice_inline_jobs(char **result, size_t *result_length, size_t *result_capacity,
+    const struct InlineJob *jobs, size_t job_count)
+{
+    // Moves the markup between the inline blocks backwards from the last block to the first, such
+    // that no bytes are overwritten before they have been moved.
+
+    size_t added_length = 0;
+    for (size_t k = 0; k < job_count; ++k) {
+        added_length += jobs[k].result_length;
+    }
+    if (*result_length + added_length + 1 > *result_capacity) {
+        char *result_realloc = realloc(*result, *result_length + added_length + 1);
+        if (result_realloc == NULL) {
+            return false;
+        }
+        *result = result_realloc;
+        *result_capacity = *result_length + added_length + 1;
+    }
+    size_t markup_end = *result_length;
+    for (size_t k = job_count; k-- > 0;) {
+        memmove(&(*result)[jobs[k].result_position + added_length], &(*result)[jobs[k].result_position],
+            markup_end - jobs[k].result_position);
+        added_length -= jobs[k].result_length;
+        memcpy(&(*result)[jobs[k].result_position + added_length], jobs[k].result, jobs[k].result_length);
+        markup_end = jobs[k].result_position;
+    }
+    for (size_t k = 0; k < job_count; ++k) {
+        *result_length += jobs[k].result_length;
+    }
+    (*result)[*result_length] = '\0';
+    return true;
+}
+
+// Tag and attribute names
+//
+// The names that change how a tag is minified are recognized once per tag or attribute, so that the
+// main loop compares enums instead of calling strnicmp on every byte of content.
+
+enum XmlhtmlName
+{
+    XMLHTML_NAME_OTHER,
+    XMLHTML_NAME_EVENT_HANDLER,
+    XMLHTML_NAME_HREF,
+    XMLHTML_NAME_PRE,
+    XMLHTML_NAME_SCRIPT,
+    XMLHTML_NAME_SRC,
+    XMLHTML_NAME_STYLE,
+    XMLHTML_NAME_TEXTAREA,
+    XMLHTML_NAME_TYPE,
+};
+
+// The event handler attributes of HTML elements and of the window, sorted for the binary search. Other
+// attributes that start with `on`, like `one` or `only`, are not JavaScript.
+
+static const char *const html_event_handler_names[] = {
+    "onabort", "onafterprint", "onanimationcancel", "onanimationend", "onanimationiteration",
+    "onanimationstart", "onauxclick", "onbeforecopy", "onbeforecut", "onbeforeinput", "onbeforematch",
+    "onbeforepaste", "onbeforeprint", "onbeforetoggle", "onbeforeunload", "onblur", "oncancel", "oncanplay",
+    "oncanplaythrough", "onchange", "onclick", "onclose", "oncommand", "oncontextlost", "oncontextmenu",
+    "oncontextrestored", "oncopy", "oncuechange", "oncut", "ondblclick", "ondrag", "ondragend", "ondragenter",
+    "ondragexit", "ondragleave", "ondragover", "ondragstart", "ondrop", "ondurationchange", "onemptied",
+    "onended", "onerror", "onfocus", "onfocusin", "onfocusout", "onformdata", "ongotpointercapture",
+    "onhashchange", "oninput", "oninvalid", "onkeydown", "onkeypress", "onkeyup", "onlanguagechange",
+    "onload", "onloadeddata", "onloadedmetadata", "onloadend", "onloadstart", "onlostpointercapture",
+    "onmessage", "onmessageerror", "onmousedown", "onmouseenter", "onmouseleave", "onmousemove", "onmouseout",
+    "onmouseover", "onmouseup", "onmousewheel", "onoffline", "ononline", "onpagehide", "onpagereveal",
+    "onpageshow", "onpageswap", "onpaste", "onpause", "onplay", "onplaying", "onpointercancel",
+    "onpointerdown", "onpointerenter", "onpointerleave", "onpointermove", "onpointerout", "onpointerover",
+    "onpointerrawupdate", "onpointerup", "onpopstate", "onprogress", "onratechange", "onrejectionhandled",
+    "onreset", "onresize", "onscroll", "onscrollend", "onsearch", "onsecuritypolicyviolation", "onseeked",
+    "onseeking", "onselect", "onselectionchange", "onselectstart", "onslotchange", "onstalled", "onstorage",
+    "onsubmit", "onsuspend", "ontimeupdate", "ontoggle", "ontouchcancel", "ontouchend", "ontouchmove",
+    "ontouchstart", "ontransitioncancel", "ontransitionend", "ontransitionrun", "ontransitionstart",
+    "onunhandledrejection", "onunload", "onvolumechange", "onwaiting", "onwheel",
+};
+
+#define XMLHTML_NAME_MAX_LENGTH (sizeof "onsecuritypolicyviolation" - 1)
+
+static bool html_is_event_handler_name(const char *folded, size_t length)
+{
+    size_t low = 0, high = sizeof html_event_handler_names / sizeof *html_event_handler_names;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const char *candidate = html_event_handler_names[middle];
+        int comparison = strncmp(candidate, folded, length);
+        if (comparison == 0 && candidate[length] == '\0') {
+            return true;
+        }
+        if (comparison < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+static ALWAYS_INLINE enum XmlhtmlName xmlhtml_name_lookup(bool is_xml, const char *name, size_t length)
+{
+    // The name is copied into a buffer of fixed size, lowercased for HTML, so that the comparisons below
+    // of constant length compile to one or two word comparisons. Setting the bit 0x20 lowercases ASCII
+    // letters and does not turn any other character into a letter.
+
+    if (length > XMLHTML_NAME_MAX_LENGTH) {
+        return XMLHTML_NAME_OTHER;
+    }
+    char folded[XMLHTML_NAME_MAX_LENGTH];
+    for (size_t k = 0; k < length; ++k) {
+        folded[k] = is_xml ? name[k] : name[k] | 0x20;
+    }
+
+#define XMLHTML_NAME_IS(string) (length == sizeof string - 1 && !memcmp(folded, string, sizeof string - 1))
+
+    if (!is_xml && length > 2 && folded[0] == 'o' && folded[1] == 'n') {
+        return html_is_event_handler_name(folded, length) ? XMLHTML_NAME_EVENT_HANDLER : XMLHTML_NAME_OTHER;
+    }
+
+    switch (length) {
+    case 3:
+        return XMLHTML_NAME_IS("pre") ? XMLHTML_NAME_PRE : XMLHTML_NAME_IS("src") ? XMLHTML_NAME_SRC :
+            XMLHTML_NAME_OTHER;
+    case 4:
+        return XMLHTML_NAME_IS("type") ? XMLHTML_NAME_TYPE : XMLHTML_NAME_IS("href") ? XMLHTML_NAME_HREF :
+            XMLHTML_NAME_OTHER;
+    case 5:
+        return XMLHTML_NAME_IS("style") ? XMLHTML_NAME_STYLE : XMLHTML_NAME_OTHER;
+    case 6:
+        return XMLHTML_NAME_IS("script") ? XMLHTML_NAME_SCRIPT : XMLHTML_NAME_OTHER;
+    case 8:
+        return XMLHTML_NAME_IS("textarea") ? XMLHTML_NAME_TEXTAREA : XMLHTML_NAME_OTHER;
+    default:
+        return XMLHTML_NAME_OTHER;
+    }
+
+#undef XMLHTML_NAME_IS
+}
+
+// Optional tags
+//
+// See https://html.spec.whatwg.org/#optional-tags. Comments are removed anyway, so the conditions
+// regarding comments always hold. Tags with attributes are never omitted. Autonomous custom elements
+// are the elements whose name contains a hyphen.
+
+struct HtmlElement
+{
+    const char *name;
+    size_t length;
+};
+
+static bool html_tag_is_one_of(const struct HtmlElement *element, const char *tags)
+{
+    return word_is_one_of(element->name, element->length, tags);
+}
+
+#define HTML_VOID_ELEMENTS "area base br col embed hr img input link meta param source track wbr"
+#define HTML_P_CLOSING_ELEMENTS "address article aside blockquote details dialog div dl fieldset figcaption " \
+    "figure footer form h1 h2 h3 h4 h5 h6 header hgroup hr main menu nav ol p pre search section table ul"
+
+// Whitespace is not rendered if the parent element is one of these
+#define HTML_WHITESPACE_INSENSITIVE_ELEMENTS "html head table thead tbody tfoot tr colgroup select optgroup"
+
+static const char *html_implicitly_closed_elements(const struct HtmlElement *start_tag)
+{
+    // Returns the elements that the start tag closes if they are still open
+
+    if (html_tag_is_one_of(start_tag, "li")) {
+        return "li";
+    }
+    if (html_tag_is_one_of(start_tag, "dt dd")) {
+        return "dt dd";
+    }
+    if (html_tag_is_one_of(start_tag, "td th")) {
+        return "td th";
+    }
+    if (html_tag_is_one_of(start_tag, "tr")) {
+        return "td th tr";
+    }
+    if (html_tag_is_one_of(start_tag, "thead tbody tfoot")) {
+        return "td th tr thead tbody tfoot";
+    }
+    if (html_tag_is_one_of(start_tag, "option")) {
+        return "option";
+    }
+    if (html_tag_is_one_of(start_tag, "optgroup")) {
+        return "option optgroup";
+    }
+    if (html_tag_is_one_of(start_tag, "rt rp")) {
+        return "rt rp";
+    }
+    if (html_tag_is_one_of(start_tag, HTML_P_CLOSING_ELEMENTS)) {
+        return "p";
+    }
+    return "";
+}
+
+static bool html_optional_tag_can_be_omitted(const struct HtmlElement *tag, bool is_end_tag,
+    const struct HtmlElement *next_tag, bool next_is_end_tag, const struct HtmlElement *parent,
+    bool has_whitespace_between)
+{
+    // `next_tag` is NULL at the end of the document and `parent` is NULL if there is no open element.
+    // Text between the tags prevents omission and must be checked by the caller.
+
+    bool next_is_start_tag = next_tag != NULL && !next_is_end_tag;
+    bool ends_parent = next_tag == NULL || next_is_end_tag;
+
+    if (!is_end_tag) {
+        if (html_tag_is_one_of(tag, "html")) {
+            return true;
+        }
+        if (html_tag_is_one_of(tag, "head")) {
+            return !has_whitespace_between && next_tag != NULL;
+        }
+        if (html_tag_is_one_of(tag, "body")) {
+            return !has_whitespace_between && next_tag != NULL &&
+                (next_is_end_tag || !html_tag_is_one_of(next_tag, "meta link script style template noscript"));
+        }
+        return false;
+    }
+    if (html_tag_is_one_of(tag, "html body")) {
+        return true;
+    }
+    if (html_tag_is_one_of(tag, "head")) {
+        return !has_whitespace_between;
+    }
+    if (html_tag_is_one_of(tag, "p")) {
+        return next_is_start_tag && html_tag_is_one_of(next_tag, HTML_P_CLOSING_ELEMENTS) ||
+            ends_parent && (parent == NULL || !html_tag_is_one_of(parent, "a audio del ins map noscript video") &&
+            memchr(parent->name, '-', parent->length) == NULL);
+    }
+    if (html_tag_is_one_of(tag, "li")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "li");
+    }
+    if (html_tag_is_one_of(tag, "dt")) {
+        return next_is_start_tag && html_tag_is_one_of(next_tag, "dt dd");
+    }
+    if (html_tag_is_one_of(tag, "dd")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "dt dd");
+    }
+    if (html_tag_is_one_of(tag, "rt rp")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "rt rp");
+    }
+    if (html_tag_is_one_of(tag, "optgroup")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "optgroup");
+    }
+    if (html_tag_is_one_of(tag, "option")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "option optgroup");
+    }
+    if (html_tag_is_one_of(tag, "thead")) {
+        return next_is_start_tag && html_tag_is_one_of(next_tag, "tbody tfoot");
+    }
+    if (html_tag_is_one_of(tag, "tbody")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "tbody tfoot");
+    }
+    if (html_tag_is_one_of(tag, "tfoot")) {
+        return ends_parent;
+    }
+    if (html_tag_is_one_of(tag, "tr")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "tr");
+    }
+    if (html_tag_is_one_of(tag, "td th")) {
+        return ends_parent || html_tag_is_one_of(next_tag, "td th");
+    }
+    return false;
+}
+
+static ALWAYS_INLINE struct Minification minify_xmlhtml(const char *xmlhtml, bool is_xml,
+    const struct MinifyOptions *options)
+{
+    size_t input_strlen = strlen(xmlhtml);
+    struct Minification m = {.result = malloc(input_strlen + 1)};
+    if (m.result == NULL) {
+        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+        return m;
+    }
+
+    enum {
+        SYNTAX_BLOCK_TAG,
+        SYNTAX_BLOCK_CONTENT,
+        SYNTAX_BLOCK_DOCTYPE,
+    } syntax_block = SYNTAX_BLOCK_CONTENT;
+
+    enum {
+        SCRIPT_TYPE_JAVASCRIPT,
+        SCRIPT_TYPE_JSON,
+        SCRIPT_TYPE_OTHER
+    } script_type;
+
+    size_t i = 0;
+    const char *current_tag;
+    size_t current_tag_length = 0;
+    enum XmlhtmlName current_tag_name = XMLHTML_NAME_OTHER;
+    bool is_closing_tag;
+    bool has_whitespace_before_tag = false;
+    const char *value, *attribute;
+    size_t value_length, attribute_length;
+    size_t result_length = 0;
+    size_t result_capacity = input_strlen + 1;
+    char *inline_content = NULL;
+    size_t inline_content_capacity = 0;
+
+    unsigned threads = options->threads == 0 ? online_processors() : options->threads;
+    bool defer_inline_blocks = threads > 1 && input_strlen >= INLINE_PARALLEL_MIN_SIZE;
+    struct InlineJob *jobs = NULL;
+    size_t job_count = 0, jobs_capacity = 0;
+    bool jobs_done = false;
+
+    // Open elements and the tag that might be omitted depending on what follows it
+
+    bool omit_optional_tags = !is_xml && options->omit_optional_tags;
+    struct HtmlElement *elements = NULL;
+    size_t element_count = 0, elements_capacity = 0;
+    struct HtmlElement tag_name = {.length = 0};
+    size_t tag_result_start;
+    struct HtmlElement optional_tag;
+    bool optional_tag_is_end_tag;
+    size_t optional_tag_result_start, optional_tag_result_length = 0;
+
+    while (true) {
+        // Beginning of inline minification
+
+        const char *tag_content_delimiter = NULL;
+        size_t tag_content_delimiter_length;
+        struct Minification (*tag_content_minify_callback)(const char *, char *, size_t *) = NULL;
+
+        if (syntax_block == SYNTAX_BLOCK_CONTENT && current_tag_name == XMLHTML_NAME_SCRIPT) {
+            tag_content_delimiter = "</script";
+            tag_content_delimiter_length = sizeof "</script" - 1;
+            if (script_type == SCRIPT_TYPE_JAVASCRIPT) {
+                tag_content_minify_callback = minify_js_into;
+            }
+            else if (script_type == SCRIPT_TYPE_JSON) {
+                tag_content_minify_callback =
+                    options->canonicalize_json_numbers ? minify_json_canonical_into : minify_json_into;
+            }
+            else if (script_type == SCRIPT_TYPE_OTHER) {
+                tag_content_minify_callback = NULL;
+            }
+        }
+        if (syntax_block == SYNTAX_BLOCK_CONTENT && current_tag_name == XMLHTML_NAME_STYLE) {
+            tag_content_delimiter = "</style";
+            tag_content_delimiter_length = sizeof "</style" - 1;
+            tag_content_minify_callback = minify_css_into;
+        }
+        if (tag_content_delimiter != NULL) {
+            size_t content_start_i = i;
+            bool in_cdata = false;
+            while (true) {
+                // Only `<` can start the delimiter or a CDATA section and only `]` can end a CDATA
+                // section, so we jump from candidate to candidate instead of comparing at every byte.
+
+                if (!is_xml) {
+                    const char *candidate = memchr(&xmlhtml[i], '<', input_strlen - i);
+                    i = candidate == NULL ? input_strlen : (size_t) (candidate - xmlhtml);
+                }
+                else if (in_cdata) {
+                    const char *candidate = memchr(&xmlhtml[i], ']', input_strlen - i);
+                    i = candidate == NULL ? input_strlen : (size_t) (candidate - xmlhtml);
+                }
+                else {
+                    i += strcspn(&xmlhtml[i], "<]");
+                }
+                if (xmlhtml[i] == '\0') {
+                    do {
+                        i -= 1;
+                    } while (is_whitespace(xmlhtml[i - 1]));
+                    m.error_position = i - 1;
+                    snprintf(m.error, sizeof m.error,
+                        "Unexpected end of document, expected `%s>` after line %%zu, column %%zu\n",
+                        tag_content_delimiter);
+                    goto error;
+                }
+                if (is_xml &&
+                    !strncmp(&xmlhtml[i], "<![CDATA[", sizeof "<![CDATA[" - 1))
+                {
+                    in_cdata = true;
+                    i += sizeof "<![CDATA[" - 1;
+                    continue;
+                }
+                if (is_xml &&
+                    !strncmp(&xmlhtml[i], "]]>", sizeof "]]>" - 1))
+                {
+                    in_cdata = false;
+                    i += sizeof "]]>" - 1;
+                    continue;
+                }
+                if (!in_cdata &&
+                    !tagncmp(is_xml, &xmlhtml[i], tag_content_delimiter, tag_content_delimiter_length))
+                {
+                    current_tag_length = 0;
+                    current_tag_name = XMLHTML_NAME_OTHER;
+                    break;
+                }
+                i += 1;
+            }
+            if (tag_content_minify_callback == NULL) {
+                memcpy(&m.result[result_length], &xmlhtml[content_start_i], i - content_start_i);
+                result_length += i - content_start_i;
+                continue;
+            }
+
+            if (defer_inline_blocks) {
+                if (job_count == jobs_capacity) {
+                    jobs_capacity = jobs_capacity == 0 ? 16 : jobs_capacity * 2;
+                    struct InlineJob *jobs_realloc = realloc(jobs, jobs_capacity * sizeof *jobs);
+                    if (jobs_realloc == NULL) {
+                        snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+                        goto error;
+                    }
+                    jobs = jobs_realloc;
+                }
+                jobs[job_count++] = (struct InlineJob) {
+                    .content_start = content_start_i,
+                    .content_length = i - content_start_i,
+                    .result_position = result_length,
+                    .minify_into = tag_content_minify_callback,
+                };
+                continue;
+            }
+
+            size_t inline_result_length;
+            struct Minification inline_m = minify_inline_content(&xmlhtml[content_start_i], i - content_start_i,
+                is_xml, tag_content_minify_callback, options->cache, options->trace, &inline_content,
+                &inline_content_capacity, &m.result, &result_capacity, result_length, input_strlen - i + 1,
+                &inline_result_length);
+            if (inline_m.result == NULL) {
+                memcpy(m.error, inline_m.error, sizeof m.error);
+                m.error_position = content_start_i + inline_m.error_position;
+                goto error;
+            }
+            result_length += inline_result_length;
+            continue;
+        }
+
+        // End of inline minification
+
+        if (xmlhtml[i] == '\0') {
+            if (syntax_block == SYNTAX_BLOCK_TAG) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error,
+                    "Unexpected end of document expected `>` after line %%zu, column %%zu\n");
+                goto error;
+            }
+            if (optional_tag_result_length > 0 && html_optional_tag_can_be_omitted(&optional_tag,
+                optional_tag_is_end_tag, NULL, false, element_count > 0 ? &elements[element_count - 1] : NULL,
+                result_length > optional_tag_result_start + optional_tag_result_length))
+            {
+                result_length = optional_tag_result_start;
+            }
+            m.result[result_length] = '\0';
+            break;
+        }
+        if (!strncmp(&xmlhtml[i], "<!--", 4)) {
+            size_t comment_start_i = i;
+            i += 4;
+            while (xmlhtml[i] != '\0' && strncmp(&xmlhtml[i], "-->", 3)) {
+                i += 1;
+            }
+            if (xmlhtml[i] == '\0') {
+                m.error_position = comment_start_i;
+                snprintf(m.error, sizeof m.error, "Unclosed comment starting in line %%zu, column %%zu\n");
+                goto error;
+            }
+            i += 3;
+
+            // Trim whitespace at the end of the document
+
+            size_t k = i;
+            while (is_whitespace(xmlhtml[k])) {
+                k += 1;
+            }
+            if (xmlhtml[k] == '\0') {
+                i = k;
+            }
+            continue;
+        }
+        if (is_xml && !strncmp(&xmlhtml[i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
+            size_t cdata_start_i = i;
+            memcpy(&m.result[result_length], "<![CDATA[", sizeof "<![CDATA[" - 1);
+            result_length += sizeof "<![CDATA[" - 1;
+            i += sizeof "<![CDATA[" - 1;
+            while (true) {
+                if (xmlhtml[i] == '\0') {
+                    m.error_position = cdata_start_i;
+                    snprintf(m.error, sizeof m.error, "Unclosed CDATA section starting in line %%zu, column %%zu\n");
+                    goto error;
+                }
+                if (!strncmp(&xmlhtml[i], "]]>", sizeof "]]>" - 1)) {
+                    memcpy(&m.result[result_length], "]]>", sizeof "]]>" - 1);
+                    result_length += sizeof "]]>" - 1;
+                    i += sizeof "]]>" - 1;
+                    break;
+                }
+                m.result[result_length++] = xmlhtml[i];
+                i += 1;
+            }
+            continue;
+        }
+        if (xmlhtml[i] == '<') {
+            // Consume `<` and tag name
+            if (syntax_block == SYNTAX_BLOCK_TAG) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "Illegal `<` in line %%zu, column %%zu\n");
+                goto error;
+            }
+            has_whitespace_before_tag =
+                result_length > 0 && is_whitespace(m.result[result_length - 1]);
+            tag_result_start = result_length;
+            m.result[result_length++] = '<';
+            i += 1;
+            if (xmlhtml[i] == '!' && !strnicmp(&xmlhtml[i], "!DOCTYPE", sizeof "!DOCTYPE" - 1)) {
+                syntax_block = SYNTAX_BLOCK_DOCTYPE;
+                tag_name.length = 0;
+                continue;
+            }
+
+            current_tag = &xmlhtml[i];
+            is_closing_tag = (xmlhtml[i] == '/');
+            if (is_closing_tag) {
+                m.result[result_length++] = '/';
+                i += 1;
+            }
+            if (!(
+                xmlhtml[i] >= 'a' && xmlhtml[i] <= 'z' ||
+                xmlhtml[i] >= 'A' && xmlhtml[i] <= 'Z' ||
+                xmlhtml[i] == ':' || xmlhtml[i] == '_' ||
+                xmlhtml[i] == '?'
+            )) {
+                m.error_position = i - 1;
+                snprintf(m.error, sizeof m.error,
+                    "`%c` in line %%zu, column %%zu is followed by an illegal character\n", xmlhtml[i - 1]);
+                goto error;
+            }
+            m.result[result_length++] = xmlhtml[i];
+            current_tag_length = 1;
+            while (
+                xmlhtml[i + current_tag_length] >= 'a' && xmlhtml[i + current_tag_length] <= 'z' ||
+                xmlhtml[i + current_tag_length] >= 'A' && xmlhtml[i + current_tag_length] <= 'Z' ||
+                xmlhtml[i + current_tag_length] >= '0' && xmlhtml[i + current_tag_length] <= '9' ||
+                xmlhtml[i + current_tag_length] == '-'
+            ) {
+                current_tag_length += 1;
+                m.result[result_length++] = xmlhtml[i + current_tag_length - 1];
+            }
+            if (
+                xmlhtml[i + current_tag_length] != '/' && xmlhtml[i + current_tag_length] != '>' &&
+                !is_whitespace(xmlhtml[i + current_tag_length])
+            ) {
+                m.error_position = i + current_tag_length;
+                snprintf(m.error, sizeof m.error,
+                    "Illegal character in tag name in in line %%zu, column %%zu\n");
+                goto error;
+            }
+            tag_name = (struct HtmlElement) {.name = &xmlhtml[i], .length = current_tag_length};
+            current_tag_name =
+                is_closing_tag ? XMLHTML_NAME_OTHER : xmlhtml_name_lookup(is_xml, tag_name.name, tag_name.length);
+            if (omit_optional_tags) {
+                if (optional_tag_result_length > 0 && html_optional_tag_can_be_omitted(&optional_tag,
+                    optional_tag_is_end_tag, &tag_name, is_closing_tag,
+                    element_count > 0 ? &elements[element_count - 1] : NULL,
+                    tag_result_start > optional_tag_result_start + optional_tag_result_length))
+                {
+                    memmove(&m.result[optional_tag_result_start],
+                        &m.result[optional_tag_result_start + optional_tag_result_length],
+                        result_length - optional_tag_result_start - optional_tag_result_length);
+                    result_length -= optional_tag_result_length;
+                    tag_result_start -= optional_tag_result_length;
+                }
+                optional_tag_result_length = 0;
+
+                if (is_closing_tag) {
+                    size_t k = element_count;
+                    while (k > 0 && (elements[k - 1].length != tag_name.length ||
+                        strnicmp(elements[k - 1].name, tag_name.name, tag_name.length)))
+                    {
+                        k -= 1;
+                    }
+                    if (k > 0) {
+                        element_count = k - 1;
+                    }
+                }
+                else {
+                    const char *closed_elements = html_implicitly_closed_elements(&tag_name);
+                    while (element_count > 0 && html_tag_is_one_of(&elements[element_count - 1], closed_elements)) {
+                        element_count -= 1;
+                    }
+                    if (!html_tag_is_one_of(&tag_name, HTML_VOID_ELEMENTS)) {
+                        if (element_count == elements_capacity) {
+                            elements_capacity = elements_capacity == 0 ? 64 : 2 * elements_capacity;
+                            STATS_ADD(STATS_HTML_ELEMENTS_REALLOC, 1);
+                            struct HtmlElement *elements_realloc =
+                                realloc(elements, elements_capacity * sizeof *elements);
+                            if (elements_realloc == NULL) {
+                                snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+                                goto error;
+                            }
+                            elements = elements_realloc;
+                        }
+                        elements[element_count++] = tag_name;
+                    }
+                }
+            }
+            syntax_block = SYNTAX_BLOCK_TAG;
+            script_type = SCRIPT_TYPE_JAVASCRIPT;
+            attribute_length = 0;
+            i += current_tag_length;
+            continue;
+        }
+        if (xmlhtml[i] == '>') {
+            if (syntax_block == SYNTAX_BLOCK_CONTENT) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "Illegal `>` in line %%zu, column %%zu\n");
+                goto error;
+            }
+            if (xmlhtml[i - 1] == '/' && m.result[result_length - 1] != '=') {
+                is_closing_tag = true;
+                if (is_xml) {
+                    // A self-closing `<script/>` has no content that would need to be minified
+                    current_tag_length = 0;
+                    current_tag_name = XMLHTML_NAME_OTHER;
+                }
+            }
+
+            // Transform `<xmlhtml></xmlhtml>` to `<xmlhtml/>`. This would be illegal for HTML.
+
+            else if (is_xml &&
+                     syntax_block != SYNTAX_BLOCK_DOCTYPE &&
+                     xmlhtml[i + 1] == '<' && xmlhtml[i + 2] == '/' &&
+                     !strncmp(current_tag, &xmlhtml[i + 3], current_tag_length) &&
+                     (is_whitespace(xmlhtml[i + 3 + current_tag_length]) ||
+                     xmlhtml[i + 3 + current_tag_length] == '>'))
+            {
+                m.result[result_length++] = '/';
+                m.result[result_length++] = '>';
+                i += 3 + current_tag_length;
+                while (xmlhtml[i] != '>' && xmlhtml[i] != '\0') {
+                    i += 1;
+                }
+                if (xmlhtml[i] == '\0') {
+                    m.error_position = i;
+                    snprintf(m.error, sizeof m.error,
+                        "Unexpected end of document expected `>` after line %%zu, column %%zu\n");
+                    goto error;
+                }
+                syntax_block = SYNTAX_BLOCK_CONTENT;
+                current_tag_length = 0;
+                current_tag_name = XMLHTML_NAME_OTHER;
+                i += 1;
+                continue;
+            }
+
+            i += 1;
+            syntax_block = SYNTAX_BLOCK_CONTENT;
+
+            if (is_xml) {
+                // Ignore whitespace except between opening and closing tags
+
+                size_t k = i;
+                while (is_whitespace(xmlhtml[k])) {
+                    k += 1;
+                }
+                if (xmlhtml[k] == '<' && (is_closing_tag || xmlhtml[k + 1] != '/')) {
+                    i = k;
+                }
+            }
+
+            // The start tags that may be omitted must not have attributes
+
+            if (omit_optional_tags && tag_name.length > 0 && (is_closing_tag ?
+                xmlhtml[i - 2] != '/' : result_length == tag_result_start + 1 + tag_name.length))
+            {
+                optional_tag = tag_name;
+                optional_tag_is_end_tag = is_closing_tag;
+                optional_tag_result_start = tag_result_start;
+                optional_tag_result_length = result_length + 1 - tag_result_start;
+            }
+            m.result[result_length++] = '>';
+
+            // Trim whitespace at the end of the document
+
+            size_t k = i;
+            while (is_whitespace(xmlhtml[k])) {
+                k += 1;
+            }
+            if (xmlhtml[k] == '\0') {
+                i = k;
+            }
+            continue;
+        }
+        if (syntax_block == SYNTAX_BLOCK_TAG && is_whitespace(xmlhtml[i])) {
+            while (is_whitespace(xmlhtml[i])) {
+                i += 1;
+            }
+            if (xmlhtml[i] != '=' && m.result[result_length - 1] != '=' && xmlhtml[i] != '>' &&
+                xmlhtml[i] != '/')
+            {
+                m.result[result_length++] = ' ';
+            }
+            if (is_closing_tag && xmlhtml[i] != '>') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error,
+                    "Illegal content in line %%zu, column %%zu after whitespace in closing tag\n");
+                goto error;
+            }
+            continue;
+        }
+        if (syntax_block == SYNTAX_BLOCK_TAG && xmlhtml[i] != '=') {
+            // Consume attribute
+            if (xmlhtml[i] == '"' || xmlhtml[i] == '\'') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error,
+                    "Illegal character `%c` in line %%zu, column %%zu\n", xmlhtml[i]);
+                goto error;
+            }
+            attribute = &xmlhtml[i];
+            attribute_length = 0;
+            while (strchr("\"' \t\r\n<>=/", xmlhtml[i]) == NULL) {
+                m.result[result_length++] = xmlhtml[i];
+                attribute_length += 1;
+                i += 1;
+            }
+            if (xmlhtml[i] == '/' && xmlhtml[i + 1] != '>') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "`/` in line %%zu, column %%zu is not followed by `>` \n");
+                goto error;
+            }
+            if (xmlhtml[i] == '/' &&xmlhtml[i + 1] == '>') {
+                if (is_xml) {
+                    m.result[result_length++] = '/';
+                }
+                i += 1;
+                continue;
+            }
+            if (strchr("=> \r\t\n/", xmlhtml[i]) == NULL) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error,
+                    "Illegal character `%c` after attribute in line %%zu, column %%zu\n", xmlhtml[i]);
+                goto error;
+            }
+            continue;
+        }
+        if (syntax_block == SYNTAX_BLOCK_TAG && xmlhtml[i] == '=') {
+            // Consume `=` followed by quoted or unquoted value
+            if (attribute_length == 0) {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "No attribute before `=` in line %%zu, column %%zu\n");
+                goto error;
+            }
+
+            i += 1;
+            while (is_whitespace(xmlhtml[i])) {
+                i += 1;
+            }
+            if (xmlhtml[i] == '=' || xmlhtml[i] == '>') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error, "No value after `=` in line %%zu, column %%zu\n");
+                goto error;
+            }
+            if (is_xml && xmlhtml[i] != '"' && xmlhtml[i] != '\'') {
+                m.error_position = i;
+                snprintf(m.error, sizeof m.error,
+                    "XML requires a quote after `=` in line %%zu, column %%zu\n");
+                goto error;
+            }
+
+            m.result[result_length++] = '=';
+            size_t value_result_start = result_length;
+            enum XmlhtmlName attribute_name = xmlhtml_name_lookup(is_xml, attribute, attribute_length);
+            if (xmlhtml[i] == '"' || xmlhtml[i] == '\'') {
+                char quote = xmlhtml[i];
+                size_t string_start_i = i;
+                i += 1;
+                value = &xmlhtml[i];
+                value_length = 0;
+                bool need_quotes;
+                if (is_xml || syntax_block == SYNTAX_BLOCK_DOCTYPE) {
+                    need_quotes = true;
+                }
+                else if (xmlhtml[i] == quote) {
+                    need_quotes = true;
+                }
+                else {
+                    const char *value_end = strchr(value, quote);
+                    need_quotes = value_end == NULL || html_attribute_needs_quotes(value, value_end - value);
+                }
+                if (need_quotes) {
+                    m.result[result_length++] = quote;
+                }
+                while (xmlhtml[i] != '\0' && xmlhtml[i] != quote) {
+                    m.result[result_length++] = xmlhtml[i];
+                    value_length += 1;
+                    i += 1;
+                }
+                if (xmlhtml[i] == '\0') {
+                    m.error_position = string_start_i;
+                    snprintf(m.error, sizeof m.error, "Unclosed string starting in line %%zu, column %%zu\n");
+                    goto error;
+                }
+                i += 1;
+                if (
+                    !is_whitespace(xmlhtml[i]) && xmlhtml[i] != '>' &&
+                    (xmlhtml[i] != '/' || xmlhtml[i + 1] != '>') &&
+                    (xmlhtml[i] != '?' || xmlhtml[i + 1] != '>')
+                ) {
+                    m.error_position = i;
+                    snprintf(m.error, sizeof m.error,
+                        "Illegal character after `%c` in line %%zu, column %%zu\n", quote);
+                    goto error;
+                }
+                if (need_quotes) {
+                    m.result[result_length++] = quote;
+                }
+            }
+            else {
+                value = &xmlhtml[i];
+                value_length = 0;
+                while (strchr(" \r\t\n >=\"'", xmlhtml[i]) == NULL) {
+                    m.result[result_length++] = xmlhtml[i];
+                    i += 1;
+                    value_length += 1;
+                }
+            }
+
+            // Rewriting references to assets with hashed names
+
+            if (!is_xml && syntax_block == SYNTAX_BLOCK_TAG && options->manifest != NULL &&
+                (attribute_name == XMLHTML_NAME_SRC || attribute_name == XMLHTML_NAME_HREF))
+            {
+                size_t path_length = 0;
+                while (path_length < value_length && value[path_length] != '?' && value[path_length] != '#') {
+                    path_length += 1;
+                }
+                size_t name_start = path_length;
+                while (name_start > 0 && value[name_start - 1] != '/') {
+                    name_start -= 1;
+                }
+                const char *hashed_name = manifest_lookup_reference(options->manifest, options->document_path,
+                    value, path_length);
+                bool is_quoted = result_length - value_result_start != value_length;
+                if (hashed_name != NULL &&
+                    (is_quoted || !html_attribute_needs_quotes(hashed_name, strlen(hashed_name))))
+                {
+                    size_t hashed_name_length = strlen(hashed_name);
+                    size_t new_result_length = result_length - (path_length - name_start) + hashed_name_length;
+                    if (new_result_length + input_strlen - i + 1 > result_capacity) {
+                        char *result_realloc = realloc(m.result, new_result_length + input_strlen - i + 1);
+                        if (result_realloc == NULL) {
+                            snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+                            goto error;
+                        }
+                        m.result = result_realloc;
+                        result_capacity = new_result_length + input_strlen - i + 1;
+                    }
+                    char *name_result = &m.result[value_result_start + is_quoted + name_start];
+                    memmove(&name_result[hashed_name_length], &name_result[path_length - name_start],
+                        &m.result[result_length] - &name_result[path_length - name_start]);
+                    memcpy(name_result, hashed_name, hashed_name_length);
+                    result_length = new_result_length;
+                }
+            }
+
+            // Minifying style and event handler attributes
+
+            if (!is_xml && syntax_block == SYNTAX_BLOCK_TAG) {
+                struct Minification (*attribute_minify_callback)(const char *, char *, size_t *) = NULL;
+                if (attribute_name == XMLHTML_NAME_STYLE) {
+                    attribute_minify_callback = minify_css_declarations_into;
+                }
+                else if (attribute_name == XMLHTML_NAME_EVENT_HANDLER) {
+                    attribute_minify_callback = minify_js_into;
+                }
+                if (attribute_minify_callback != NULL) {
+                    double start = trace_start(options->trace);
+                    size_t minified_length;
+                    struct Minification attribute_m = minify_html_attribute(value, value_length,
+                        attribute_minify_callback, &inline_content, &inline_content_capacity,
+                        &m.result[value_result_start], result_length - value_result_start, &minified_length);
+                    if (attribute_m.result == NULL) {
+                        memcpy(m.error, attribute_m.error, sizeof m.error);
+                        m.error_position = value - xmlhtml;
+                        goto error;
+                    }
+                    if (minified_length > 0) {
+                        result_length = value_result_start + minified_length;
+                    }
+                    trace_end(options->trace,
+                        attribute_minify_callback == minify_js_into ? TRACE_EVENT_HANDLER : TRACE_STYLE_ATTRIBUTE,
+                        start, value_length, result_length - value_result_start);
+                }
+            }
+
+            // Checking script type
+
+            if (current_tag_name == XMLHTML_NAME_SCRIPT && attribute_name == XMLHTML_NAME_TYPE) {
+                if (xmlhtml_attribute_equals(value, value_length, "application/json+ld")) {
+                    script_type = SCRIPT_TYPE_JSON;
+                }
+                else if (xmlhtml_attribute_equals(value, value_length, "importmap")) {
+                    script_type = SCRIPT_TYPE_JSON;
+                }
+                else if (xmlhtml_attribute_equals(value, value_length, "module")) {
+                    script_type = SCRIPT_TYPE_JAVASCRIPT;
+                }
+                else if (xmlhtml_attribute_equals(value, value_length, "text/javascript")) {
+                    script_type = SCRIPT_TYPE_JAVASCRIPT;
+                }
+                else {
+                    script_type = SCRIPT_TYPE_OTHER;
+                }
+            }
+            continue;
+        }
+        if (!is_xml && syntax_block == SYNTAX_BLOCK_CONTENT && is_whitespace(xmlhtml[i])) {
+            // Whitespace is significant in the content of `pre` and `textarea`
+            if (current_tag_name == XMLHTML_NAME_PRE || current_tag_name == XMLHTML_NAME_TEXTAREA) {
+                m.result[result_length++] = xmlhtml[i];
+                i += 1;
+                continue;
+            }
             while (is_whitespace(xmlhtml[i])) {
                 i += 1;
             }
-            if (xmlhtml[i] != '=' && m.result[result_length - 1] != '=' && xmlhtml[i] != '>' &&
-                xmlhtml[i] != '/')
+            if (has_whitespace_before_tag && result_length > 0 && m.result[result_length - 1] == '>') {
+                continue;
+            }
+            if (omit_optional_tags && xmlhtml[i] == '<' && element_count > 0 &&
+                html_tag_is_one_of(&elements[element_count - 1], HTML_WHITESPACE_INSENSITIVE_ELEMENTS))
+            {
+                continue;
+            }
+            m.result[result_length++] = ' ';
+            continue;
+        }
+        if (syntax_block == SYNTAX_BLOCK_CONTENT) {
+            // Text prevents omitting the preceding tag
+            optional_tag_result_length = 0;
+        }
+        m.result[result_length++] = xmlhtml[i];
+        i += 1;
+    }
+    if (job_count > 0) {
+        run_inline_jobs(xmlhtml, is_xml, options->cache, options->trace, jobs, job_count, threads);
+        jobs_done = true;
+        for (size_t k = 0; k < job_count; ++k) {
+            if (jobs[k].m.result == NULL) {
+                goto error;
+            }
+        }
+        if (!splice_inline_jobs(&m.result, &result_length, &result_capacity, jobs, job_count)) {
+            snprintf(m.error, sizeof m.error, "Cannot allocate memory\n");
+            goto error;
+        }
+        for (size_t k = 0; k < job_count; ++k) {
+            free(jobs[k].result);
+        }
+    }
+    free(jobs);
+    free(inline_content);
+    free(elements);
+    return m;
+
+error:
+    // The inline blocks precede the position of any error in the markup, so the first failed block
+    // has the earliest error.
+
+    if (job_count > 0 && !jobs_done) {
+        run_inline_jobs(xmlhtml, is_xml, options->cache, options->trace, jobs, job_count, threads);
+    }
+    for (size_t k = 0; k < job_count; ++k) {
+        if (jobs[k].m.result == NULL) {
+            memcpy(m.error, jobs[k].m.error, sizeof m.error);
+            m.error_position = jobs[k].m.error_position;
+            break;
+        }
+    }
+    for (size_t k = 0; k < job_count; ++k) {
+        free(jobs[k].result);
+    }
+    free(jobs);
+    free(inline_content);
+    free(elements);
+    free(m.result);
+    m.result = NULL;
+    return m;
+}
+
+// XML and HTML are compiled separately, so that each has its own comparisons of tag names inlined and HTML
+// does not branch on XML features such as CDATA sections in its loops
+static struct Minification minify_xml_with_options(const char *xml, const struct MinifyOptions *options)
+{
+    return minify_xmlhtml(xml, true, options);
+}
+
+static struct Minification minify_html_with_options(const char *html, const struct MinifyOptions *options)
+{
+    return minify_xmlhtml(html, false, options);
+}
+
+struct Minification minify_xml(const char *xml)
+{
+    return minify_xml_with_options(xml, &default_options);
+}
+
+struct Minification minify_html(const char *html)
+{
+    return minify_html_with_options(html, &default_options);
+}
+
+struct LineColumn
+{
+    size_t line;
+    size_t column;
+};
+
+static void advance_line_column(struct LineColumn *lc, const char *text, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] == '\n') {
+            lc->line += 1;
+            lc->column = 0;
+        }
+        else {
+            lc->column += 1;
+        }
+    }
+}
+
+struct LineColumn position_to_line_column(const char *text, size_t position)
+{
+    struct LineColumn lc = {.line = 1, .column = 0};
+    advance_line_column(&lc, text, position + 1);
+    return lc;
+}
+
+// Streaming XML minification
+//
+// Huge XML documents are cut into segments at positions where the minifier carries no state from one
+// segment into the next: before an opening tag or between two characters of text in the content of an
+// element. Each segment is minified with `minify_xml` and written out before the next one is read, so
+// the memory use is bounded by the largest segment, which in the worst case is the largest tag,
+// comment, CDATA section or inline script.
+
+#define XML_STREAM_CHUNK_SIZE 65536
+
+// The longest token the scanner needs to look ahead is `<![CDATA[`
+#define XML_STREAM_LOOKAHEAD (sizeof "<![CDATA[" - 1)
+
+struct XmlStreamScanner
+{
+    enum {
+        XML_STREAM_CONTENT,
+        XML_STREAM_TAG,
+        XML_STREAM_ATTRIBUTE_VALUE,
+        XML_STREAM_COMMENT,
+        XML_STREAM_CDATA,
+        XML_STREAM_INLINE_CONTENT,
+    } state;
+    char quote;
+    const char *inline_delimiter;
+    const char *tag_inline_delimiter;
+    bool inline_in_cdata;
+    bool whitespace_after_comment;
+};
+
+static bool is_xml_stream_text(char c)
+{
+    return c != '\0' && c != '<' && c != '>' && c != '&' && c != ']' && !is_whitespace(c);
+}
+
+static bool is_xml_stream_tag(const char *name, const char *tag)
+{
+    size_t tag_length = strlen(tag);
+    return !strncmp(name, tag, tag_length) &&
+        !isalnum((unsigned char) name[tag_length]) && name[tag_length] != '-';
+}
+
+static size_t xml_stream_scan(struct XmlStreamScanner *s, const char *buffer, size_t *position, size_t end)
+{
+    // Returns the last position before `end` where the document can be cut, or 0 if there is none.
+    // The states mirror how `minify_xmlhtml` tokenizes XML. Invalid input may merely prevent cuts;
+    // the errors are reported by the minifier.
+
+    size_t cut = 0;
+    size_t i = *position;
+    while (i < end) {
+        if (s->state == XML_STREAM_CONTENT) {
+            if (!strncmp(&buffer[i], "<!--", sizeof "<!--" - 1)) {
+                s->state = XML_STREAM_COMMENT;
+                i += sizeof "<!--" - 1;
+                continue;
+            }
+            if (!strncmp(&buffer[i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
+                s->state = XML_STREAM_CDATA;
+                s->whitespace_after_comment = false;
+                i += sizeof "<![CDATA[" - 1;
+                continue;
+            }
+            if (buffer[i] == '<') {
+                // Whitespace after a comment is only trimmed at the end of the document
+
+                if (i > 0 && !(s->whitespace_after_comment && is_whitespace(buffer[i - 1])) &&
+                    (isalpha((unsigned char) buffer[i + 1]) || buffer[i + 1] == '_' || buffer[i + 1] == ':'))
+                {
+                    cut = i;
+                }
+                s->tag_inline_delimiter =
+                    is_xml_stream_tag(&buffer[i + 1], "script") ? "</script" :
+                    is_xml_stream_tag(&buffer[i + 1], "style") ? "</style" : NULL;
+                s->state = XML_STREAM_TAG;
+                s->whitespace_after_comment = false;
+                i += 1;
+                continue;
+            }
+            if (!is_whitespace(buffer[i])) {
+                s->whitespace_after_comment = false;
+                if (i > 0 && is_xml_stream_text(buffer[i - 1]) && is_xml_stream_text(buffer[i])) {
+                    cut = i;
+                }
+            }
+            i += 1;
+        }
+        else if (s->state == XML_STREAM_TAG) {
+            if (buffer[i] == '"' || buffer[i] == '\'') {
+                s->state = XML_STREAM_ATTRIBUTE_VALUE;
+                s->quote = buffer[i];
+            }
+            else if (buffer[i] == '>') {
+                if (s->tag_inline_delimiter != NULL && buffer[i - 1] != '/') {
+                    s->state = XML_STREAM_INLINE_CONTENT;
+                    s->inline_delimiter = s->tag_inline_delimiter;
+                    s->inline_in_cdata = false;
+                }
+                else {
+                    s->state = XML_STREAM_CONTENT;
+                }
+            }
+            i += 1;
+        }
+        else if (s->state == XML_STREAM_ATTRIBUTE_VALUE) {
+            if (buffer[i] == s->quote) {
+                s->state = XML_STREAM_TAG;
+            }
+            i += 1;
+        }
+        else if (s->state == XML_STREAM_COMMENT) {
+            if (!strncmp(&buffer[i], "-->", sizeof "-->" - 1)) {
+                s->state = XML_STREAM_CONTENT;
+                s->whitespace_after_comment = true;
+                i += sizeof "-->" - 1;
+                continue;
+            }
+            i += 1;
+        }
+        else if (s->state == XML_STREAM_CDATA) {
+            if (!strncmp(&buffer[i], "]]>", sizeof "]]>" - 1)) {
+                s->state = XML_STREAM_CONTENT;
+                i += sizeof "]]>" - 1;
+                continue;
+            }
+            i += 1;
+        }
+        else {
+            if (!strncmp(&buffer[i], "<![CDATA[", sizeof "<![CDATA[" - 1)) {
+                s->inline_in_cdata = true;
+                i += sizeof "<![CDATA[" - 1;
+                continue;
+            }
+            if (!strncmp(&buffer[i], "]]>", sizeof "]]>" - 1)) {
+                s->inline_in_cdata = false;
+                i += sizeof "]]>" - 1;
+                continue;
+            }
+            if (!s->inline_in_cdata &&
+                !strncmp(&buffer[i], s->inline_delimiter, strlen(s->inline_delimiter)))
+            {
+                s->state = XML_STREAM_TAG;
+                s->tag_inline_delimiter = NULL;
+            }
+            i += 1;
+        }
+    }
+    *position = i;
+    return cut;
+}
+
+static bool minify_xml_segment(char *segment, size_t length, FILE *output, struct Minification *m,
+    struct LineColumn *line_column)
+{
+    // `line_column` holds the position after the previous segment and is advanced past this segment
+
+    char cut_character = segment[length];
+    segment[length] = '\0';
+    struct Minification segment_m = minify_xml(segment);
+    if (segment_m.result == NULL) {
+        memcpy(m->error, segment_m.error, sizeof m->error);
+        if (length > 0) {
+            advance_line_column(line_column, segment,
+                (segment_m.error_position < length ? segment_m.error_position : length - 1) + 1);
+        }
+        segment[length] = cut_character;
+        return false;
+    }
+    segment[length] = cut_character;
+    advance_line_column(line_column, segment, length);
+    size_t result_length = strlen(segment_m.result);
+    bool written = fwrite(segment_m.result, 1, result_length, output) == result_length;
+    free(segment_m.result);
+    if (!written) {
+        snprintf(m->error, sizeof m->error, "Cannot write output: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool minify_xml_stream(FILE *input, FILE *output, struct Minification *m,
+    struct LineColumn *error_line_column)
+{
+    // On failure, `m->error` is set and `error_line_column` receives the position of the error
+
+    struct XmlStreamScanner scanner = {.state = XML_STREAM_CONTENT};
+    struct LineColumn line_column = {.line = 1, .column = 0};
+    size_t capacity = 0, length = 0, scanned = 0;
+    char *buffer = NULL;
+    m->result = NULL;
+
+    while (true) {
+        if (capacity < length + XML_STREAM_CHUNK_SIZE + 1) {
+            capacity = capacity * 2 > length + XML_STREAM_CHUNK_SIZE + 1 ?
+                capacity * 2 : length + XML_STREAM_CHUNK_SIZE + 1;
+            char *buffer_realloc = realloc(buffer, capacity);
+            if (buffer_realloc == NULL) {
+                snprintf(m->error, sizeof m->error, "Cannot allocate memory\n");
+                goto error;
+            }
+            buffer = buffer_realloc;
+        }
+        length += fread(&buffer[length], 1, XML_STREAM_CHUNK_SIZE, input);
+        if (ferror(input)) {
+            snprintf(m->error, sizeof m->error, "Cannot read input: %s\n", strerror(errno));
+            goto error;
+        }
+        buffer[length] = '\0';
+        if (feof(input)) {
+            if (!minify_xml_segment(buffer, length, output, m, &line_column)) {
+                goto error;
+            }
+            break;
+        }
+        if (length <= XML_STREAM_LOOKAHEAD) {
+            continue;
+        }
+        size_t cut = xml_stream_scan(&scanner, buffer, &scanned, length - XML_STREAM_LOOKAHEAD);
+        if (cut == 0) {
+            continue;
+        }
+        if (!minify_xml_segment(buffer, cut, output, m, &line_column)) {
+            goto error;
+        }
+        memmove(buffer, &buffer[cut], length - cut);
+        length -= cut;
+        scanned -= cut;
+    }
+    free(buffer);
+    return true;
+
+error:
+    *error_line_column = line_column;
+    free(buffer);
+    return false;
+}
+
+// Compression
+//
+// Encoders for the precompressed sidecar files that web servers deliver to clients accepting gzip or
+// Brotli. Like pigz, large inputs are split into chunks that are compressed in parallel. A chunk may
+// refer back into the data preceding it and ends on a byte boundary, so the compressed chunks are
+// simply concatenated.
+
+#define LZ77_HASH_BITS 15
+#define LZ77_HASH_LENGTH 3
+#define HUFFMAN_MAX_SYMBOLS 704
+
+struct BitWriter
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    uint64_t bits;
+    unsigned bit_count;
+    bool failed;
+};
+
+static bool bit_writer_reserve(struct BitWriter *writer, size_t length)
+{
+    if (writer->failed) {
+        return false;
+    }
+    if (writer->length + length > writer->capacity) {
+        size_t capacity = 2 * writer->capacity + length;
+        unsigned char *data_realloc = realloc(writer->data, capacity);
+        if (data_realloc == NULL) {
+            writer->failed = true;
+            writer->bit_count = 0;
+            return false;
+        }
+        writer->data = data_realloc;
+        writer->capacity = capacity;
+    }
+    return true;
+}
+
+static void bit_writer_put(struct BitWriter *writer, uint32_t value, unsigned count)
+{
+    // Deflate and Brotli pack bits starting at the least significant bit of each byte. `count` must not
+    // exceed 32.
+
+    writer->bits |= (uint64_t) value << writer->bit_count;
+    writer->bit_count += count;
+    if (writer->bit_count >= 32) {
+        if (!bit_writer_reserve(writer, 4)) {
+            return;
+        }
+        for (size_t k = 0; k < 4; ++k) {
+            writer->data[writer->length++] = writer->bits & 0xFF;
+            writer->bits >>= 8;
+        }
+        writer->bit_count -= 32;
+    }
+}
+
+static void bit_writer_align(struct BitWriter *writer)
+{
+    while (writer->bit_count > 0) {
+        if (!bit_writer_reserve(writer, 1)) {
+            return;
+        }
+        writer->data[writer->length++] = writer->bits & 0xFF;
+        writer->bits >>= 8;
+        writer->bit_count = writer->bit_count > 8 ? writer->bit_count - 8 : 0;
+    }
+    writer->bits = 0;
+}
+
+static void bit_writer_bytes(struct BitWriter *writer, const void *data, size_t length)
+{
+    if (length > 0 && bit_writer_reserve(writer, length)) {
+        memcpy(&writer->data[writer->length], data, length);
+        writer->length += length;
+    }
+}
+
+static void huffman_code_lengths(const uint32_t *frequencies, size_t count, unsigned max_length,
+    uint8_t *lengths)
+{
+    // Builds a Huffman code with the two-queue method. If it is deeper than `max_length`, the
+    // frequencies are halved until it fits, which costs little compared to optimal length-limited codes.
+
+    struct {uint32_t weight; uint16_t symbol;} leaves[HUFFMAN_MAX_SYMBOLS];
+    uint32_t internal_weights[HUFFMAN_MAX_SYMBOLS];
+    uint16_t leaf_parents[HUFFMAN_MAX_SYMBOLS], internal_parents[HUFFMAN_MAX_SYMBOLS];
+    uint8_t internal_depths[HUFFMAN_MAX_SYMBOLS];
+    uint32_t scaled[HUFFMAN_MAX_SYMBOLS];
+    memcpy(scaled, frequencies, count * sizeof *scaled);
+    memset(lengths, 0, count);
+
+    while (true) {
+        size_t leaf_count = 0;
+        for (size_t k = 0; k < count; ++k) {
+            if (scaled[k] > 0) {
+                // Insertion sort, the alphabets are small
+                size_t position = leaf_count++;
+                while (position > 0 && leaves[position - 1].weight > scaled[k]) {
+                    leaves[position] = leaves[position - 1];
+                    position -= 1;
+                }
+                leaves[position].weight = scaled[k];
+                leaves[position].symbol = k;
+            }
+        }
+        if (leaf_count == 1) {
+            lengths[leaves[0].symbol] = 1;
+            return;
+        }
+        if (leaf_count == 0) {
+            return;
+        }
+
+        size_t next_leaf = 0, next_internal = 0;
+        for (size_t internal_count = 0; internal_count < leaf_count - 1; ++internal_count) {
+            internal_weights[internal_count] = 0;
+            for (size_t pick = 0; pick < 2; ++pick) {
+                if (next_leaf < leaf_count && (next_internal == internal_count ||
+                    leaves[next_leaf].weight <= internal_weights[next_internal]))
+                {
+                    internal_weights[internal_count] += leaves[next_leaf].weight;
+                    leaf_parents[next_leaf++] = internal_count;
+                }
+                else {
+                    internal_weights[internal_count] += internal_weights[next_internal];
+                    internal_parents[next_internal++] = internal_count;
+                }
+            }
+        }
+
+        // Parents are created after their children, so depths are known from the root downwards
+
+        unsigned depth = 0;
+        internal_depths[leaf_count - 2] = 0;
+        for (size_t k = leaf_count - 2; k-- > 0;) {
+            internal_depths[k] = internal_depths[internal_parents[k]] + 1;
+        }
+        for (size_t k = 0; k < leaf_count; ++k) {
+            lengths[leaves[k].symbol] = internal_depths[leaf_parents[k]] + 1;
+            depth = lengths[leaves[k].symbol] > depth ? lengths[leaves[k].symbol] : depth;
+        }
+        if (depth <= max_length) {
+            return;
+        }
+        for (size_t k = 0; k < count; ++k) {
+            scaled[k] = (scaled[k] + 1) / 2;
+        }
+    }
+}
+
+static void huffman_codes(const uint8_t *lengths, size_t count, uint16_t *codes)
+{
+    // Canonical codes as in RFC 1951, section 3.2.2, bit-reversed for the bit writer
+
+    uint16_t length_counts[16] = {0};
+    uint16_t next_codes[16];
+    for (size_t k = 0; k < count; ++k) {
+        length_counts[lengths[k]] += 1;
+    }
+    length_counts[0] = 0;
+    uint16_t code = 0;
+    for (size_t bits = 1; bits < 16; ++bits) {
+        code = (code + length_counts[bits - 1]) << 1;
+        next_codes[bits] = code;
+    }
+    for (size_t k = 0; k < count; ++k) {
+        if (lengths[k] == 0) {
+            continue;
+        }
+        uint16_t forward = next_codes[lengths[k]]++;
+        uint16_t reversed = 0;
+        for (size_t bit = 0; bit < lengths[k]; ++bit) {
+            reversed = (reversed << 1) | ((forward >> bit) & 1);
+        }
+        codes[k] = reversed;
+    }
+}
+
+struct Lz77Level
+{
+    // Like zlib: the number of hash chain entries to search, the match length that ends the search,
+    // and the match length up to which the next position is tried for a longer match
+    uint16_t max_chain;
+    uint16_t nice_length;
+    uint16_t max_lazy;
+};
+
+struct Lz77Symbol
+{
+    // A literal byte if `dist` is 0, otherwise a match
+    uint32_t length;
+    uint32_t dist;
+};
+
+static uint32_t lz77_hash(const unsigned char *data)
+{
+    uint32_t bytes = data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16;
+    return (bytes * 2654435761u) >> (32 - LZ77_HASH_BITS);
+}
+
+static size_t lz77_parse(const unsigned char *data, size_t length, size_t start, size_t end, size_t window_size,
+    size_t min_length, size_t max_length, struct Lz77Level level, struct Lz77Symbol *symbols)
+{
+    // Parses `data[start..end)` into literals and matches, which may start up to `window_size` bytes
+    // before `start`. Returns the number of symbols or SIZE_MAX if out of memory. Positions in the hash
+    // chains are stored plus 1 relative to `base`, such that 0 means no position.
+
+    size_t base = start > window_size ? start - window_size : 0;
+    uint32_t *heads = calloc(1 << LZ77_HASH_BITS, sizeof *heads);
+    uint32_t *chain = malloc(window_size * sizeof *chain);
+    if (heads == NULL || chain == NULL) {
+        free(heads);
+        free(chain);
+        return SIZE_MAX;
+    }
+
+    size_t inserted = base;
+    size_t symbol_count = 0;
+    size_t position = start;
+    while (position < end) {
+        size_t match_length = 0, match_dist = 0;
+        for (size_t attempt = 0; attempt < 2; ++attempt) {
+            // The second attempt looks for a longer match at the next position
+
+            size_t at = position + attempt;
+            size_t available = end - at < max_length ? end - at : max_length;
+            if (attempt == 1 && (match_length < min_length || match_length >= level.max_lazy ||
+                available <= match_length))
             {
-                m.result[result_length++] = ' ';
+                break;
             }
-            if (is_closing_tag && xmlhtml[i] != '>') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error,
-                    "Illegal content in line %%zu, column %%zu after whitespace in closing tag\n");
-                goto error;
+            while (inserted < at && inserted + LZ77_HASH_LENGTH <= length) {
+                uint32_t hash = lz77_hash(&data[inserted]);
+                chain[inserted % window_size] = heads[hash];
+                heads[hash] = inserted - base + 1;
+                inserted += 1;
+            }
+            if (available < min_length || at + LZ77_HASH_LENGTH > length) {
+                break;
+            }
+            size_t best_length = attempt == 0 ? min_length - 1 : match_length;
+            size_t best_dist = 0;
+            uint32_t candidate = heads[lz77_hash(&data[at])];
+            for (size_t chain_length = 0; candidate != 0 && chain_length < level.max_chain; ++chain_length) {
+                size_t candidate_position = base + candidate - 1;
+                if (at - candidate_position > window_size) {
+                    break;
+                }
+                if (data[candidate_position + best_length] == data[at + best_length]) {
+                    size_t candidate_length = 0;
+                    while (candidate_length < available &&
+                        data[candidate_position + candidate_length] == data[at + candidate_length])
+                    {
+                        candidate_length += 1;
+                    }
+                    if (candidate_length > best_length) {
+                        best_length = candidate_length;
+                        best_dist = at - candidate_position;
+                        if (best_length >= level.nice_length || best_length == available) {
+                            break;
+                        }
+                    }
+                }
+                uint32_t next = chain[candidate_position % window_size];
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+            if (best_dist == 0) {
+                continue;
+            }
+            if (attempt == 1) {
+                symbols[symbol_count++] = (struct Lz77Symbol) {.length = data[position], .dist = 0};
+                position += 1;
+            }
+            match_length = best_length;
+            match_dist = best_dist;
+        }
+        if (match_dist > 0) {
+            symbols[symbol_count++] = (struct Lz77Symbol) {.length = match_length, .dist = match_dist};
+            position += match_length;
+        }
+        else {
+            symbols[symbol_count++] = (struct Lz77Symbol) {.length = data[position], .dist = 0};
+            position += 1;
+        }
+    }
+    free(heads);
+    free(chain);
+    return symbol_count;
+}
+
+struct CompressJob
+{
+    size_t start;
+    size_t end;
+    bool is_last;
+    unsigned char *result;
+    size_t result_length;
+    bool failed;
+};
+
+struct CompressJobQueue
+{
+    const unsigned char *data;
+    size_t length;
+    int level;
+    bool (*compress_chunk)(const unsigned char *, size_t, size_t, size_t, int, bool, struct BitWriter *);
+    struct CompressJob *jobs;
+    size_t job_count;
+    size_t next_job;
+    pthread_mutex_t mutex;
+};
+
+static void *compress_job_worker(void *queue_pointer)
+{
+    struct CompressJobQueue *queue = queue_pointer;
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        size_t job_i = queue->next_job++;
+        pthread_mutex_unlock(&queue->mutex);
+        if (job_i >= queue->job_count) {
+            break;
+        }
+        struct CompressJob *job = &queue->jobs[job_i];
+        struct BitWriter writer = {.data = NULL};
+        job->failed = !queue->compress_chunk(queue->data, queue->length, job->start, job->end, queue->level,
+            job->is_last, &writer);
+        job->result = writer.data;
+        job->result_length = writer.length;
+    }
+    return NULL;
+}
+
+static bool compress_chunks(const unsigned char *data, size_t length, size_t chunk_size, int level,
+    unsigned threads,
+    bool (*compress_chunk)(const unsigned char *, size_t, size_t, size_t, int, bool, struct BitWriter *),
+    struct BitWriter *output)
+{
+    // Appends the byte-aligned compressed chunks to `output`. There is at least one chunk, even for
+    // empty data, so that the last one can end the stream.
+
+    size_t job_count = length == 0 ? 1 : (length + chunk_size - 1) / chunk_size;
+    struct CompressJob *jobs = calloc(job_count, sizeof *jobs);
+    if (jobs == NULL) {
+        return false;
+    }
+    for (size_t k = 0; k < job_count; ++k) {
+        jobs[k].start = k * chunk_size;
+        jobs[k].end = k + 1 == job_count ? length : (k + 1) * chunk_size;
+        jobs[k].is_last = k + 1 == job_count;
+    }
+    struct CompressJobQueue queue = {.data = data, .length = length, .level = level,
+        .compress_chunk = compress_chunk, .jobs = jobs, .job_count = job_count};
+    pthread_mutex_init(&queue.mutex, NULL);
+
+    // The calling thread is one of the workers
+
+    size_t worker_count = threads - 1 < job_count - 1 ? threads - 1 : job_count - 1;
+    pthread_t *workers = malloc(worker_count * sizeof *workers);
+    if (workers == NULL) {
+        worker_count = 0;
+    }
+    size_t started = 0;
+    while (started < worker_count && !pthread_create(&workers[started], NULL, compress_job_worker, &queue)) {
+        started += 1;
+    }
+    compress_job_worker(&queue);
+    for (size_t k = 0; k < started; ++k) {
+        pthread_join(workers[k], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&queue.mutex);
+
+    bool success = true;
+    for (size_t k = 0; k < job_count; ++k) {
+        success = success && !jobs[k].failed;
+        if (success) {
+            bit_writer_bytes(output, jobs[k].result, jobs[k].result_length);
+        }
+        free(jobs[k].result);
+    }
+    free(jobs);
+    return success && !output->failed;
+}
+
+// Gzip compression
+//
+// A deflate encoder (RFC 1951) in a gzip container (RFC 1952). A chunk may refer back into the 32 KiB
+// preceding it and ends with an empty stored block.
+
+#define DEFLATE_CHUNK_SIZE (128 << 10)
+#define DEFLATE_WINDOW_SIZE (32 << 10)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_SYMBOLS 16384
+#define DEFLATE_LITLEN_CODES 288
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CODELEN_CODES 19
+
+static const uint16_t deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195,
+    227, 258
+};
+static const uint8_t deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t deflate_codelen_order[DEFLATE_CODELEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Each level searches at least as far as the one below it. A deeper search finds longer matches at larger
+// distances, which can cost more than they save on repetitive input, so all levels above 3 search the
+// same number of chain entries and only differ in the match lengths that end the search. This keeps the
+// output from growing with the level on the benchmark documents and on repetitive input.
+static const struct Lz77Level deflate_levels[10] = {
+    {0, 0, 0}, {4, 8, 0}, {4, 8, 4}, {4, 8, 8}, {4096, 32, 32},
+    {4096, 64, 32}, {4096, 128, 32}, {4096, 128, 128}, {4096, 258, 128}, {4096, 258, 258},
+};
+static size_t deflate_length_code(size_t length)
+{
+    size_t code = 0;
+    while (code < 28 && deflate_length_base[code + 1] <= length) {
+        code += 1;
+    }
+    return code;
+}
+
+static size_t deflate_dist_code(size_t dist)
+{
+    size_t code = 0;
+    while (code < 29 && deflate_dist_base[code + 1] <= dist) {
+        code += 1;
+    }
+    return code;
+}
+
+static void deflate_write_stored(struct BitWriter *writer, const unsigned char *data, size_t length,
+    bool is_final)
+{
+    do {
+        size_t block_length = length > 65535 ? 65535 : length;
+        length -= block_length;
+        bit_writer_put(writer, is_final && length == 0, 1);
+        bit_writer_put(writer, 0, 2);
+        bit_writer_align(writer);
+        unsigned char header[4] = {
+            block_length & 0xFF, block_length >> 8, ~block_length & 0xFF, (~block_length >> 8) & 0xFF
+        };
+        bit_writer_bytes(writer, header, sizeof header);
+        bit_writer_bytes(writer, data, block_length);
+        data += block_length;
+    } while (length > 0);
+}
+
+static void deflate_write_block(struct BitWriter *writer, const struct Lz77Symbol *symbols,
+    size_t symbol_count, const unsigned char *data, size_t length, bool is_final)
+{
+    // Writes the symbols with dynamic or fixed Huffman codes or the data as stored block, whichever
+    // is the shortest
+
+    uint32_t litlen_frequencies[DEFLATE_LITLEN_CODES] = {0};
+    uint32_t dist_frequencies[DEFLATE_DIST_CODES] = {0};
+    size_t extra_bits = 0;
+    for (size_t k = 0; k < symbol_count; ++k) {
+        if (symbols[k].dist == 0) {
+            litlen_frequencies[symbols[k].length] += 1;
+        }
+        else {
+            size_t length_code = deflate_length_code(symbols[k].length);
+            size_t dist_code = deflate_dist_code(symbols[k].dist);
+            litlen_frequencies[257 + length_code] += 1;
+            dist_frequencies[dist_code] += 1;
+            extra_bits += deflate_length_extra[length_code] + deflate_dist_extra[dist_code];
+        }
+    }
+    litlen_frequencies[256] = 1;
+
+    // Some decoders reject distance codes with fewer than two symbols
+
+    size_t dist_used = 0;
+    for (size_t k = 0; k < DEFLATE_DIST_CODES; ++k) {
+        dist_used += dist_frequencies[k] > 0;
+    }
+    for (size_t k = 0; dist_used < 2; ++k) {
+        if (dist_frequencies[k] == 0) {
+            dist_frequencies[k] = 1;
+            dist_used += 1;
+        }
+    }
+
+    uint8_t lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint8_t *litlen_lengths = lengths, *dist_lengths = &lengths[DEFLATE_LITLEN_CODES];
+    huffman_code_lengths(litlen_frequencies, DEFLATE_LITLEN_CODES, 15, litlen_lengths);
+    huffman_code_lengths(dist_frequencies, DEFLATE_DIST_CODES, 15, dist_lengths);
+    size_t litlen_count = DEFLATE_LITLEN_CODES, dist_count = DEFLATE_DIST_CODES;
+    while (litlen_lengths[litlen_count - 1] == 0) {
+        litlen_count -= 1;
+    }
+    while (dist_count > 1 && dist_lengths[dist_count - 1] == 0) {
+        dist_count -= 1;
+    }
+
+    // Run-length encoding of the code lengths with the symbols 16 (repeat), 17 and 18 (zeros)
+
+    memmove(&lengths[litlen_count], dist_lengths, dist_count);
+    dist_lengths = &lengths[litlen_count];
+    size_t all_count = litlen_count + dist_count;
+    uint8_t codelen_symbols[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint8_t codelen_extra[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    size_t codelen_symbol_count = 0;
+    uint32_t codelen_frequencies[DEFLATE_CODELEN_CODES] = {0};
+    for (size_t k = 0; k < all_count;) {
+        size_t run = 1;
+        while (k + run < all_count && lengths[k + run] == lengths[k]) {
+            run += 1;
+        }
+        if (lengths[k] == 0 && run >= 3) {
+            run = run > 138 ? 138 : run;
+            codelen_symbols[codelen_symbol_count] = run >= 11 ? 18 : 17;
+            codelen_extra[codelen_symbol_count++] = run >= 11 ? run - 11 : run - 3;
+        }
+        else if (lengths[k] != 0 && run >= 4) {
+            run = run > 7 ? 7 : run;
+            codelen_symbols[codelen_symbol_count] = lengths[k];
+            codelen_extra[codelen_symbol_count++] = 0;
+            codelen_frequencies[lengths[k]] += 1;
+            codelen_symbols[codelen_symbol_count] = 16;
+            codelen_extra[codelen_symbol_count++] = run - 4;
+        }
+        else {
+            run = 1;
+            codelen_symbols[codelen_symbol_count] = lengths[k];
+            codelen_extra[codelen_symbol_count++] = 0;
+        }
+        codelen_frequencies[codelen_symbols[codelen_symbol_count - 1]] += 1;
+        k += run;
+    }
+    uint8_t codelen_lengths[DEFLATE_CODELEN_CODES];
+    uint16_t codelen_codes[DEFLATE_CODELEN_CODES];
+    huffman_code_lengths(codelen_frequencies, DEFLATE_CODELEN_CODES, 7, codelen_lengths);
+    huffman_codes(codelen_lengths, DEFLATE_CODELEN_CODES, codelen_codes);
+    size_t codelen_count = DEFLATE_CODELEN_CODES;
+    while (codelen_count > 4 && codelen_lengths[deflate_codelen_order[codelen_count - 1]] == 0) {
+        codelen_count -= 1;
+    }
+
+    size_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * codelen_count + extra_bits;
+    for (size_t k = 0; k < codelen_symbol_count; ++k) {
+        dynamic_bits += codelen_lengths[codelen_symbols[k]];
+        dynamic_bits += codelen_symbols[k] == 16 ? 2 : codelen_symbols[k] == 17 ? 3 : codelen_symbols[k] == 18 ? 7 : 0;
+    }
+    size_t fixed_bits = 3 + extra_bits;
+    for (size_t k = 0; k < DEFLATE_LITLEN_CODES; ++k) {
+        dynamic_bits += litlen_frequencies[k] * litlen_lengths[k];
+        fixed_bits += litlen_frequencies[k] * (k < 144 ? 8 : k < 256 ? 9 : k < 280 ? 7 : 8);
+    }
+    for (size_t k = 0; k < dist_count; ++k) {
+        dynamic_bits += dist_frequencies[k] * dist_lengths[k];
+        fixed_bits += dist_frequencies[k] * 5;
+    }
+    size_t stored_bits = 8 * (length + 5 * (length / 65535 + 1)) + 7;
+
+    if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits) {
+        deflate_write_stored(writer, data, length, is_final);
+        return;
+    }
+
+    uint8_t fixed_lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint16_t litlen_codes[DEFLATE_LITLEN_CODES], dist_codes[DEFLATE_DIST_CODES];
+    bit_writer_put(writer, is_final, 1);
+    if (fixed_bits <= dynamic_bits) {
+        for (size_t k = 0; k < DEFLATE_LITLEN_CODES; ++k) {
+            fixed_lengths[k] = k < 144 ? 8 : k < 256 ? 9 : k < 280 ? 7 : 8;
+        }
+        memset(&fixed_lengths[DEFLATE_LITLEN_CODES], 5, DEFLATE_DIST_CODES);
+        litlen_lengths = fixed_lengths;
+        dist_lengths = &fixed_lengths[DEFLATE_LITLEN_CODES];
+        litlen_count = DEFLATE_LITLEN_CODES;
+        dist_count = DEFLATE_DIST_CODES;
+        bit_writer_put(writer, 1, 2);
+    }
+    else {
+        bit_writer_put(writer, 2, 2);
+        bit_writer_put(writer, litlen_count - 257, 5);
+        bit_writer_put(writer, dist_count - 1, 5);
+        bit_writer_put(writer, codelen_count - 4, 4);
+        for (size_t k = 0; k < codelen_count; ++k) {
+            bit_writer_put(writer, codelen_lengths[deflate_codelen_order[k]], 3);
+        }
+        for (size_t k = 0; k < codelen_symbol_count; ++k) {
+            bit_writer_put(writer, codelen_codes[codelen_symbols[k]], codelen_lengths[codelen_symbols[k]]);
+            if (codelen_symbols[k] >= 16) {
+                bit_writer_put(writer, codelen_extra[k],
+                    codelen_symbols[k] == 16 ? 2 : codelen_symbols[k] == 17 ? 3 : 7);
             }
+        }
+    }
+    huffman_codes(litlen_lengths, litlen_count, litlen_codes);
+    huffman_codes(dist_lengths, dist_count, dist_codes);
+    for (size_t k = 0; k < symbol_count; ++k) {
+        if (symbols[k].dist == 0) {
+            bit_writer_put(writer, litlen_codes[symbols[k].length], litlen_lengths[symbols[k].length]);
+            continue;
+        }
+        size_t length_code = deflate_length_code(symbols[k].length);
+        size_t dist_code = deflate_dist_code(symbols[k].dist);
+        bit_writer_put(writer, litlen_codes[257 + length_code], litlen_lengths[257 + length_code]);
+        bit_writer_put(writer, symbols[k].length - deflate_length_base[length_code],
+            deflate_length_extra[length_code]);
+        bit_writer_put(writer, dist_codes[dist_code], dist_lengths[dist_code]);
+        bit_writer_put(writer, symbols[k].dist - deflate_dist_base[dist_code], deflate_dist_extra[dist_code]);
+    }
+    bit_writer_put(writer, litlen_codes[256], litlen_lengths[256]);
+}
+
+
+static bool deflate_chunk(const unsigned char *data, size_t length, size_t start, size_t end, int level,
+    bool is_last, struct BitWriter *writer)
+{
+    struct Lz77Symbol *symbols = malloc((end - start + 1) * sizeof *symbols);
+    if (symbols == NULL) {
+        return false;
+    }
+    size_t symbol_count = 0;
+    if (level == 0) {
+        deflate_write_stored(writer, &data[start], end - start, is_last);
+    }
+    else {
+        symbol_count = lz77_parse(data, length, start, end, DEFLATE_WINDOW_SIZE, DEFLATE_MIN_MATCH,
+            DEFLATE_MAX_MATCH, deflate_levels[level], symbols);
+        if (symbol_count == SIZE_MAX) {
+            free(symbols);
+            return false;
+        }
+    }
+    size_t block_start = start;
+    for (size_t k = 0; k < symbol_count; k += DEFLATE_BLOCK_SYMBOLS) {
+        size_t block_symbol_count = symbol_count - k < DEFLATE_BLOCK_SYMBOLS ? symbol_count - k : DEFLATE_BLOCK_SYMBOLS;
+        size_t block_length = 0;
+        for (size_t i = k; i < k + block_symbol_count; ++i) {
+            block_length += symbols[i].dist == 0 ? 1 : symbols[i].length;
+        }
+        deflate_write_block(writer, &symbols[k], block_symbol_count, &data[block_start], block_length,
+            is_last && k + block_symbol_count == symbol_count);
+        block_start += block_length;
+    }
+    if (level > 0 && start == end) {
+        deflate_write_block(writer, symbols, 0, &data[start], 0, is_last);
+    }
+    if (!is_last) {
+        // An empty stored block ends the chunk on a byte boundary
+        deflate_write_stored(writer, NULL, 0, false);
+    }
+    bit_writer_align(writer);
+    free(symbols);
+    return !writer->failed;
+}
+
+static uint32_t crc32(const unsigned char *data, size_t length)
+{
+    uint32_t table[256];
+    for (uint32_t k = 0; k < 256; ++k) {
+        uint32_t crc = k;
+        for (size_t bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[k] = crc;
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t k = 0; k < length; ++k) {
+        crc = table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static bool gzip_compress(const char *input, size_t length, int level, unsigned threads, char **output,
+    size_t *output_length)
+{
+    // Returns the gzip file in `*output`, which the caller must free
+
+    const unsigned char *data = (const unsigned char *) input;
+    struct BitWriter writer = {.data = NULL};
+
+    // Header without modification time and file name, see RFC 1952
+    unsigned char header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, level == 9 ? 2 : level == 1 ? 4 : 0, 3};
+    bit_writer_bytes(&writer, header, sizeof header);
+    bool success = compress_chunks(data, length, DEFLATE_CHUNK_SIZE, level, threads, deflate_chunk, &writer);
+    uint32_t checksum = crc32(data, length);
+    unsigned char footer[8];
+    for (size_t k = 0; k < 4; ++k) {
+        footer[k] = (checksum >> (8 * k)) & 0xFF;
+        footer[4 + k] = ((uint32_t) length >> (8 * k)) & 0xFF;
+    }
+    bit_writer_bytes(&writer, footer, sizeof footer);
+    if (!success || writer.failed) {
+        free(writer.data);
+        return false;
+    }
+    *output = (char *) writer.data;
+    *output_length = writer.length;
+    return true;
+}
+
+// Brotli compression
+//
+// A Brotli encoder (RFC 7932) that uses neither the static dictionary nor context modeling. Every
+// meta-block has one prefix code for literals, commands and distances each. A chunk may refer back into
+// the 256 KiB preceding it and ends with an empty metadata block. As the decoder's last distance is
+// unknown at the start of a chunk, the distance code for it is only used once a chunk has set it.
+
+#define BROTLI_CHUNK_SIZE (1 << 20)
+#define BROTLI_WINDOW_BITS 19
+#define BROTLI_LOOKBACK_SIZE (256 << 10)
+#define BROTLI_METABLOCK_SIZE (128 << 10)
+#define BROTLI_MIN_MATCH 4
+#define BROTLI_MAX_MATCH 4096
+#define BROTLI_LITERAL_CODES 256
+#define BROTLI_COMMAND_CODES 704
+#define BROTLI_DISTANCE_CODES 64
+#define BROTLI_CODELEN_CODES 18
+
+static const uint32_t brotli_insert_base[24] = {
+    0, 1, 2, 3, 4, 5, 6, 8, 10, 14, 18, 26, 34, 50, 66, 98, 130, 194, 322, 578, 1090, 2114, 6210, 22594
+};
+static const uint8_t brotli_insert_extra[24] = {
+    0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 7, 8, 9, 10, 12, 14, 24
+};
+static const uint32_t brotli_copy_base[24] = {
+    2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 18, 22, 30, 38, 54, 70, 102, 134, 198, 326, 582, 1094, 2118
+};
+static const uint8_t brotli_copy_extra[24] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 7, 8, 9, 10, 24
+};
+static const uint8_t brotli_codelen_order[BROTLI_CODELEN_CODES] = {
+    1, 2, 3, 4, 0, 5, 17, 6, 16, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// The fixed code for the code lengths of the code length code, indexed by the length
+static const uint8_t brotli_codelen_length_codes[6] = {0, 7, 3, 2, 1, 15};
+static const uint8_t brotli_codelen_length_lengths[6] = {2, 4, 3, 2, 2, 4};
+
+// Like the deflate levels, the qualities form three groups that search the same number of chain entries,
+// so that a higher quality does not find longer matches further back that cost more than they save
+static const struct Lz77Level brotli_qualities[12] = {
+    {1, 16, 0}, {1, 2048, 8}, {1, 2048, 16}, {1, 2048, 32}, {128, 32, 4}, {128, 64, 4},
+    {128, 256, 4}, {2048, 32, 32}, {2048, 64, 32}, {2048, 128, 32}, {2048, 128, 2048}, {2048, 256, 128},
+};
+
+struct BrotliPrefixCode
+{
+    size_t alphabet_size;
+    uint8_t lengths[BROTLI_COMMAND_CODES];
+    uint16_t codes[BROTLI_COMMAND_CODES];
+
+    // A simple prefix code lists up to four symbols, ordered by their code lengths
+    size_t simple_count;
+    uint16_t simple_symbols[4];
+    bool tree_select;
+
+    // A complex prefix code stores the run-length encoded code lengths with their own prefix code
+    size_t token_count;
+    uint8_t tokens[BROTLI_COMMAND_CODES];
+    uint8_t token_extra[BROTLI_COMMAND_CODES];
+    uint8_t codelen_lengths[BROTLI_CODELEN_CODES];
+    uint16_t codelen_codes[BROTLI_CODELEN_CODES];
+    size_t codelen_used;
+
+    size_t header_bits;
+};
+
+static size_t brotli_insert_code(size_t length)
+{
+    size_t code = 0;
+    while (code < 23 && brotli_insert_base[code + 1] <= length) {
+        code += 1;
+    }
+    return code;
+}
+
+static size_t brotli_copy_code(size_t length)
+{
+    size_t code = 0;
+    while (code < 23 && brotli_copy_base[code + 1] <= length) {
+        code += 1;
+    }
+    return code;
+}
+
+static uint16_t brotli_command_code(size_t insert_code, size_t copy_code, bool use_last_distance)
+{
+    // The insert-and-copy length code table of RFC 7932, section 5, in cells of 64 codes
+
+    static const uint16_t cells[3][3] = {{128, 192, 384}, {256, 320, 512}, {448, 576, 640}};
+    uint16_t low_bits = (insert_code & 7) << 3 | (copy_code & 7);
+    if (use_last_distance && insert_code < 8 && copy_code < 16) {
+        return (copy_code < 8 ? 0 : 64) | low_bits;
+    }
+    return cells[insert_code >> 3][copy_code >> 3] | low_bits;
+}
+
+static void brotli_distance_code(size_t dist, uint16_t *code, uint32_t *extra, unsigned *extra_bits)
+{
+    // Distance codes from 16 on with NPOSTFIX = 0 and NDIRECT = 0, see RFC 7932, section 4
+
+    size_t value = dist + 3;
+    unsigned top_bit = 0;
+    while (value >> (top_bit + 1) != 0) {
+        top_bit += 1;
+    }
+    *extra_bits = top_bit - 1;
+    *code = 16 + 2 * (*extra_bits - 1) + ((value >> *extra_bits) & 1);
+    *extra = value & ((1u << *extra_bits) - 1);
+}
+
+static void brotli_tokens_repeat(struct BrotliPrefixCode *code, uint8_t token, size_t repetitions)
+{
+    // Consecutive repeat codes multiply their counts, so the extra bits are written most significant
+    // group first. See RFC 7932, section 3.5.
+
+    size_t first = code->token_count;
+    unsigned shift = token == 16 ? 2 : 3;
+    repetitions -= 3;
+    while (true) {
+        code->tokens[code->token_count] = token;
+        code->token_extra[code->token_count++] = repetitions & ((1 << shift) - 1);
+        repetitions >>= shift;
+        if (repetitions == 0) {
+            break;
+        }
+        repetitions -= 1;
+    }
+    for (size_t i = first, j = code->token_count - 1; i < j; ++i, --j) {
+        uint8_t swap = code->token_extra[i];
+        code->token_extra[i] = code->token_extra[j];
+        code->token_extra[j] = swap;
+    }
+}
+
+static void brotli_build_prefix_code(const uint32_t *frequencies, size_t alphabet_size,
+    struct BrotliPrefixCode *code)
+{
+    code->alphabet_size = alphabet_size;
+    code->simple_count = 0;
+    code->token_count = 0;
+    memset(code->lengths, 0, alphabet_size);
+    unsigned alphabet_bits = 0;
+    while ((size_t) 1 << alphabet_bits < alphabet_size) {
+        alphabet_bits += 1;
+    }
+
+    for (size_t k = 0; k < alphabet_size; ++k) {
+        if (frequencies[k] == 0) {
             continue;
         }
-        if (syntax_block == SYNTAX_BLOCK_TAG && xmlhtml[i] != '=') {
-            // Consume attribute
-            if (xmlhtml[i] == '"' || xmlhtml[i] == '\'') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error,
-                    "Illegal character `%c` in line %%zu, column %%zu\n", xmlhtml[i]);
-                goto error;
-            }
-            attribute = &xmlhtml[i];
-            attribute_length = 0;
-            while (strchr("\"' \t\r\n<>=/", xmlhtml[i]) == NULL) {
-                m.result[result_length++] = xmlhtml[i];
-                attribute_length += 1;
-                i += 1;
-            }
-            if (xmlhtml[i] == '/' && xmlhtml[i + 1] != '>') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "`/` in line %%zu, column %%zu is not followed by `>` \n");
-                goto error;
-            }
-            if (xmlhtml[i] == '/' &&xmlhtml[i + 1] == '>') {
-                if (is_xml) {
-                    m.result[result_length++] = '/';
-                }
-                i += 1;
-                continue;
-            }
-            if (strchr("=> \r\t\n/", xmlhtml[i]) == NULL) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error,
-                    "Illegal character `%c` after attribute in line %%zu, column %%zu\n", xmlhtml[i]);
-                goto error;
+        if (code->simple_count == 4) {
+            code->simple_count = 5;
+            break;
+        }
+        // Insertion sort by descending frequency
+        size_t position = code->simple_count++;
+        while (position > 0 && frequencies[code->simple_symbols[position - 1]] < frequencies[k]) {
+            code->simple_symbols[position] = code->simple_symbols[position - 1];
+            position -= 1;
+        }
+        code->simple_symbols[position] = k;
+    }
+
+    if (code->simple_count <= 4) {
+        if (code->simple_count == 0) {
+            code->simple_symbols[code->simple_count++] = 0;
+        }
+        const uint16_t *symbols = code->simple_symbols;
+        code->tree_select = false;
+        if (code->simple_count == 1) {
+            // A single symbol takes no bits
+            code->codes[symbols[0]] = 0;
+        }
+        else if (code->simple_count == 2) {
+            code->lengths[symbols[0]] = code->lengths[symbols[1]] = 1;
+        }
+        else if (code->simple_count == 3) {
+            code->lengths[symbols[0]] = 1;
+            code->lengths[symbols[1]] = code->lengths[symbols[2]] = 2;
+        }
+        else if (code->simple_count == 4) {
+            code->tree_select = frequencies[symbols[0]] > frequencies[symbols[2]] + frequencies[symbols[3]];
+            code->lengths[symbols[0]] = code->tree_select ? 1 : 2;
+            code->lengths[symbols[1]] = 2;
+            code->lengths[symbols[2]] = code->lengths[symbols[3]] = code->tree_select ? 3 : 2;
+        }
+        huffman_codes(code->lengths, alphabet_size, code->codes);
+        code->header_bits = 4 + code->simple_count * alphabet_bits + (code->simple_count == 4);
+        return;
+    }
+
+    huffman_code_lengths(frequencies, alphabet_size, 15, code->lengths);
+    huffman_codes(code->lengths, alphabet_size, code->codes);
+
+    // Run-length encoding of the code lengths. The decoder starts with 8 as previous nonzero length.
+
+    size_t used_length = alphabet_size;
+    while (code->lengths[used_length - 1] == 0) {
+        used_length -= 1;
+    }
+    uint8_t previous = 8;
+    for (size_t k = 0; k < used_length;) {
+        uint8_t value = code->lengths[k];
+        size_t repetitions = 1;
+        while (k + repetitions < used_length && code->lengths[k + repetitions] == value) {
+            repetitions += 1;
+        }
+        k += repetitions;
+        if (value != 0 && value != previous) {
+            code->tokens[code->token_count] = value;
+            code->token_extra[code->token_count++] = 0;
+            repetitions -= 1;
+        }
+        if (value != 0 && repetitions == 7) {
+            code->tokens[code->token_count] = value;
+            code->token_extra[code->token_count++] = 0;
+            repetitions -= 1;
+        }
+        if (value == 0 && repetitions == 11) {
+            code->tokens[code->token_count] = 0;
+            code->token_extra[code->token_count++] = 0;
+            repetitions -= 1;
+        }
+        if (repetitions < 3) {
+            for (size_t i = 0; i < repetitions; ++i) {
+                code->tokens[code->token_count] = value;
+                code->token_extra[code->token_count++] = 0;
             }
+        }
+        else {
+            brotli_tokens_repeat(code, value == 0 ? 17 : 16, repetitions);
+        }
+        previous = value != 0 ? value : previous;
+    }
+
+    uint32_t codelen_frequencies[BROTLI_CODELEN_CODES] = {0};
+    for (size_t k = 0; k < code->token_count; ++k) {
+        codelen_frequencies[code->tokens[k]] += 1;
+    }
+    huffman_code_lengths(codelen_frequencies, BROTLI_CODELEN_CODES, 5, code->codelen_lengths);
+    huffman_codes(code->codelen_lengths, BROTLI_CODELEN_CODES, code->codelen_codes);
+    code->codelen_used = 0;
+    for (size_t k = 0; k < BROTLI_CODELEN_CODES; ++k) {
+        code->codelen_used += code->codelen_lengths[k] != 0;
+    }
+
+    code->header_bits = 2;
+    for (size_t k = 0; k < BROTLI_CODELEN_CODES; ++k) {
+        code->header_bits += brotli_codelen_length_lengths[code->codelen_lengths[brotli_codelen_order[k]]];
+    }
+    for (size_t k = 0; k < code->token_count; ++k) {
+        code->header_bits += code->codelen_used > 1 ? code->codelen_lengths[code->tokens[k]] : 0;
+        code->header_bits += code->tokens[k] == 16 ? 2 : code->tokens[k] == 17 ? 3 : 0;
+    }
+}
+
+static void brotli_write_prefix_code(struct BitWriter *writer, const struct BrotliPrefixCode *code)
+{
+    if (code->simple_count <= 4) {
+        unsigned alphabet_bits = 0;
+        while ((size_t) 1 << alphabet_bits < code->alphabet_size) {
+            alphabet_bits += 1;
+        }
+        bit_writer_put(writer, 1, 2);
+        bit_writer_put(writer, code->simple_count - 1, 2);
+        for (size_t k = 0; k < code->simple_count; ++k) {
+            bit_writer_put(writer, code->simple_symbols[k], alphabet_bits);
+        }
+        if (code->simple_count == 4) {
+            bit_writer_put(writer, code->tree_select, 1);
+        }
+        return;
+    }
+
+    // Trailing zero lengths are omitted, except if there is only one code length. Its code then does not
+    // fill the code space and it takes no bits.
+
+    size_t codelen_count = BROTLI_CODELEN_CODES;
+    while (code->codelen_used > 1 && code->codelen_lengths[brotli_codelen_order[codelen_count - 1]] == 0) {
+        codelen_count -= 1;
+    }
+    size_t skip = 0;
+    if (code->codelen_lengths[brotli_codelen_order[0]] == 0 && code->codelen_lengths[brotli_codelen_order[1]] == 0) {
+        skip = code->codelen_lengths[brotli_codelen_order[2]] == 0 ? 3 : 2;
+    }
+    bit_writer_put(writer, skip, 2);
+    for (size_t k = skip; k < codelen_count; ++k) {
+        uint8_t length = code->codelen_lengths[brotli_codelen_order[k]];
+        bit_writer_put(writer, brotli_codelen_length_codes[length], brotli_codelen_length_lengths[length]);
+    }
+    for (size_t k = 0; k < code->token_count; ++k) {
+        uint8_t token = code->tokens[k];
+        if (code->codelen_used > 1) {
+            bit_writer_put(writer, code->codelen_codes[token], code->codelen_lengths[token]);
+        }
+        if (token >= 16) {
+            bit_writer_put(writer, code->token_extra[k], token == 16 ? 2 : 3);
+        }
+    }
+}
+
+static void brotli_write_length_header(struct BitWriter *writer, size_t length, bool is_uncompressed)
+{
+    // ISLAST = 0, MNIBBLES, MLEN - 1 and ISUNCOMPRESSED
+
+    size_t nibbles = 4;
+    while (nibbles < 6 && (length - 1) >> (4 * nibbles) != 0) {
+        nibbles += 1;
+    }
+    bit_writer_put(writer, 0, 1);
+    bit_writer_put(writer, nibbles - 4, 2);
+    bit_writer_put(writer, length - 1, 4 * nibbles);
+    bit_writer_put(writer, is_uncompressed, 1);
+}
+
+static void brotli_write_metablock(struct BitWriter *writer, const struct Lz77Symbol *symbols,
+    size_t symbol_count, const unsigned char *data, size_t length, size_t *last_dist)
+{
+    // Writes a compressed or an uncompressed meta-block, whichever is shorter. `*last_dist` is the
+    // decoder's last distance or 0 if it is unknown.
+
+    uint32_t literal_frequencies[BROTLI_LITERAL_CODES] = {0};
+    uint32_t command_frequencies[BROTLI_COMMAND_CODES] = {0};
+    uint32_t distance_frequencies[BROTLI_DISTANCE_CODES] = {0};
+    size_t extra_bits = 0;
+    size_t dist = *last_dist;
+    for (size_t k = 0, insert_length = 0; k <= symbol_count; ++k) {
+        if (k < symbol_count && symbols[k].dist == 0) {
+            literal_frequencies[symbols[k].length] += 1;
+            insert_length += 1;
             continue;
         }
-        if (syntax_block == SYNTAX_BLOCK_TAG && xmlhtml[i] == '=') {
-            // Consume `=` followed by quoted or unquoted value
-            if (attribute_length == 0) {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "No attribute before `=` in line %%zu, column %%zu\n");
-                goto error;
-            }
+        if (k == symbol_count && insert_length == 0) {
+            break;
+        }
+        size_t insert_code = brotli_insert_code(insert_length);
+        extra_bits += brotli_insert_extra[insert_code];
+        insert_length = 0;
+        if (k == symbol_count) {
+            // Trailing literals end the meta-block before the copy length takes effect
+            command_frequencies[brotli_command_code(insert_code, 0, true)] += 1;
+            break;
+        }
+        size_t copy_code = brotli_copy_code(symbols[k].length);
+        extra_bits += brotli_copy_extra[copy_code];
+        bool is_last_dist = symbols[k].dist == dist;
+        uint16_t command = brotli_command_code(insert_code, copy_code, is_last_dist);
+        command_frequencies[command] += 1;
+        if (command >= 128) {
+            uint16_t dist_code = 0;
+            uint32_t dist_extra;
+            unsigned dist_extra_bits = 0;
+            if (!is_last_dist) {
+                brotli_distance_code(symbols[k].dist, &dist_code, &dist_extra, &dist_extra_bits);
+            }
+            distance_frequencies[dist_code] += 1;
+            extra_bits += dist_extra_bits;
+        }
+        dist = symbols[k].dist;
+    }
 
-            i += 1;
-            while (is_whitespace(xmlhtml[i])) {
-                i += 1;
-            }
-            if (xmlhtml[i] == '=' || xmlhtml[i] == '>') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error, "No value after `=` in line %%zu, column %%zu\n");
-                goto error;
-            }
-            if (is_xml && xmlhtml[i] != '"' && xmlhtml[i] != '\'') {
-                m.error_position = i;
-                snprintf(m.error, sizeof m.error,
-                    "XML requires a quote after `=` in line %%zu, column %%zu\n");
-                goto error;
-            }
+    struct BrotliPrefixCode *codes = malloc(3 * sizeof *codes);
+    if (codes == NULL) {
+        writer->failed = true;
+        return;
+    }
+    brotli_build_prefix_code(literal_frequencies, BROTLI_LITERAL_CODES, &codes[0]);
+    brotli_build_prefix_code(command_frequencies, BROTLI_COMMAND_CODES, &codes[1]);
+    brotli_build_prefix_code(distance_frequencies, BROTLI_DISTANCE_CODES, &codes[2]);
+    size_t compressed_bits = 40 + codes[0].header_bits + codes[1].header_bits + codes[2].header_bits + extra_bits;
+    for (size_t k = 0; k < BROTLI_LITERAL_CODES; ++k) {
+        compressed_bits += literal_frequencies[k] * codes[0].lengths[k];
+    }
+    for (size_t k = 0; k < BROTLI_COMMAND_CODES; ++k) {
+        compressed_bits += command_frequencies[k] * codes[1].lengths[k];
+    }
+    for (size_t k = 0; k < BROTLI_DISTANCE_CODES; ++k) {
+        compressed_bits += distance_frequencies[k] * codes[2].lengths[k];
+    }
 
-            m.result[result_length++] = '=';
-            if (xmlhtml[i] == '"' || xmlhtml[i] == '\'') {
-                char quote = xmlhtml[i];
-                size_t string_start_i = i;
-                i += 1;
-                value = &xmlhtml[i];
-                value_length = 0;
-                bool need_quotes;
-                if (is_xml || syntax_block == SYNTAX_BLOCK_DOCTYPE) {
-                    need_quotes = true;
-                }
-                else if (xmlhtml[i] == quote) {
-                    need_quotes = true;
-                }
-                else {
-                    need_quotes = false;
-                    size_t k = i;
-                    while (xmlhtml[k] != quote) {
-                        if (strchr(" \r\t\n=\"'/", xmlhtml[k]) != NULL) {
-                            need_quotes = true;
-                            break;
-                        }
-                        k += 1;
-                    }
-                }
-                if (need_quotes) {
-                    m.result[result_length++] = quote;
-                }
-                while (xmlhtml[i] != '\0' && xmlhtml[i] != quote) {
-                    m.result[result_length++] = xmlhtml[i];
-                    value_length += 1;
-                    i += 1;
-                }
-                if (xmlhtml[i] == '\0') {
-                    m.error_position = string_start_i;
-                    snprintf(m.error, sizeof m.error, "Unclosed string starting in line %%zu, column %%zu\n");
-                    goto error;
-                }
-                i += 1;
-                if (
-                    !is_whitespace(xmlhtml[i]) && xmlhtml[i] != '>' &&
-                    (xmlhtml[i] != '/' || xmlhtml[i + 1] != '>') &&
-                    (xmlhtml[i] != '?' || xmlhtml[i + 1] != '>')
-                ) {
-                    m.error_position = i;
-                    snprintf(m.error, sizeof m.error,
-                        "Illegal character after `%c` in line %%zu, column %%zu\n", quote);
-                    goto error;
-                }
-                if (need_quotes) {
-                    m.result[result_length++] = quote;
-                }
-            }
-            else {
-                value = &xmlhtml[i];
-                value_length = 0;
-                while (strchr(" \r\t\n >=\"'", xmlhtml[i]) == NULL) {
-                    m.result[result_length++] = xmlhtml[i];
-                    i += 1;
-                    value_length += 1;
-                }
-            }
+    if (compressed_bits >= 8 * length + 32) {
+        brotli_write_length_header(writer, length, true);
+        bit_writer_align(writer);
+        bit_writer_bytes(writer, data, length);
+        free(codes);
+        return;
+    }
 
-            // Checking script type
+    brotli_write_length_header(writer, length, false);
+    bit_writer_put(writer, 0, 3);  // One block type for literals, commands and distances each
+    bit_writer_put(writer, 0, 6);  // NPOSTFIX = 0, NDIRECT = 0
+    bit_writer_put(writer, 0, 2);  // Context mode of the literals
+    bit_writer_put(writer, 0, 2);  // One prefix code for literals and distances each
+    for (size_t k = 0; k < 3; ++k) {
+        brotli_write_prefix_code(writer, &codes[k]);
+    }
+
+    const struct BrotliPrefixCode *literal_code = &codes[0], *command_code = &codes[1], *distance_code = &codes[2];
+    size_t literal_start = 0;
+    for (size_t k = 0, insert_length = 0; k <= symbol_count; ++k) {
+        if (k < symbol_count && symbols[k].dist == 0) {
+            insert_length += 1;
+            continue;
+        }
+        if (k == symbol_count && insert_length == 0) {
+            break;
+        }
+        size_t insert_code = brotli_insert_code(insert_length);
+        size_t copy_code = k < symbol_count ? brotli_copy_code(symbols[k].length) : 0;
+        bool is_last_dist = k < symbol_count && symbols[k].dist == *last_dist;
+        uint16_t command = brotli_command_code(insert_code, copy_code, is_last_dist || k == symbol_count);
+        bit_writer_put(writer, command_code->codes[command], command_code->lengths[command]);
+        bit_writer_put(writer, insert_length - brotli_insert_base[insert_code], brotli_insert_extra[insert_code]);
+        if (k < symbol_count) {
+            bit_writer_put(writer, symbols[k].length - brotli_copy_base[copy_code], brotli_copy_extra[copy_code]);
+        }
+        for (size_t i = literal_start; i < literal_start + insert_length; ++i) {
+            uint8_t literal = symbols[i].length;
+            bit_writer_put(writer, literal_code->codes[literal], literal_code->lengths[literal]);
+        }
+        if (k == symbol_count) {
+            break;
+        }
+        if (command >= 128) {
+            uint16_t dist_code = 0;
+            uint32_t dist_extra = 0;
+            unsigned dist_extra_bits = 0;
+            if (!is_last_dist) {
+                brotli_distance_code(symbols[k].dist, &dist_code, &dist_extra, &dist_extra_bits);
+            }
+            bit_writer_put(writer, distance_code->codes[dist_code], distance_code->lengths[dist_code]);
+            bit_writer_put(writer, dist_extra, dist_extra_bits);
+        }
+        *last_dist = symbols[k].dist;
+        insert_length = 0;
+        literal_start = k + 1;
+    }
+    free(codes);
+}
+
+static bool brotli_chunk(const unsigned char *data, size_t length, size_t start, size_t end, int quality,
+    bool is_last, struct BitWriter *writer)
+{
+    struct Lz77Symbol *symbols = malloc((end - start + 1) * sizeof *symbols);
+    if (symbols == NULL) {
+        return false;
+    }
+    size_t symbol_count = lz77_parse(data, length, start, end, BROTLI_LOOKBACK_SIZE, BROTLI_MIN_MATCH,
+        BROTLI_MAX_MATCH, brotli_qualities[quality], symbols);
+    if (symbol_count == SIZE_MAX) {
+        free(symbols);
+        return false;
+    }
+    if (start == 0) {
+        // WBITS, see RFC 7932, section 9.1
+        bit_writer_put(writer, 1, 1);
+        bit_writer_put(writer, BROTLI_WINDOW_BITS - 17, 3);
+    }
+
+    size_t last_dist = 0;
+    size_t block_start = start, block_symbol_start = 0, block_length = 0;
+    for (size_t k = 0; k < symbol_count; ++k) {
+        block_length += symbols[k].dist == 0 ? 1 : symbols[k].length;
+        if (block_length >= BROTLI_METABLOCK_SIZE || k + 1 == symbol_count) {
+            brotli_write_metablock(writer, &symbols[block_symbol_start], k + 1 - block_symbol_start,
+                &data[block_start], block_length, &last_dist);
+            block_start += block_length;
+            block_symbol_start = k + 1;
+            block_length = 0;
+        }
+    }
+    if (is_last) {
+        // ISLAST = 1, ISLASTEMPTY = 1
+        bit_writer_put(writer, 3, 2);
+    }
+    else {
+        // An empty metadata block ends the chunk on a byte boundary: ISLAST = 0, MNIBBLES = 0, reserved
+        // bit and MSKIPBYTES = 0
+        bit_writer_put(writer, 0, 1);
+        bit_writer_put(writer, 3, 2);
+        bit_writer_put(writer, 0, 3);
+    }
+    bit_writer_align(writer);
+    free(symbols);
+    return !writer->failed;
+}
+
+static bool brotli_compress(const char *input, size_t length, int quality, unsigned threads, char **output,
+    size_t *output_length)
+{
+    // Returns the Brotli stream in `*output`, which the caller must free
+
+    struct BitWriter writer = {.data = NULL};
+    if (!compress_chunks((const unsigned char *) input, length, BROTLI_CHUNK_SIZE, quality, threads,
+        brotli_chunk, &writer))
+    {
+        free(writer.data);
+        return false;
+    }
+    *output = (char *) writer.data;
+    *output_length = writer.length;
+    return true;
+}
+
+enum Format {FORMAT_JS, FORMAT_CSS, FORMAT_XML, FORMAT_HTML, FORMAT_JSON};
+
+static struct Minification minify_format(const char *input, enum Format format, const struct MinifyOptions *options)
+{
+    switch (format) {
+    case FORMAT_JS:
+        return minify_js(input);
+    case FORMAT_CSS:
+        return minify_css(input);
+    case FORMAT_XML:
+        return minify_xml_with_options(input, options);
+    case FORMAT_HTML:
+        return minify_html_with_options(input, options);
+    case FORMAT_JSON:
+    default:
+        return options->canonicalize_json_numbers ?
+            minify_allocated(input, minify_json_canonical_into) : minify_json(input);
+    }
+}
+
+enum Compression {COMPRESSION_GZIP, COMPRESSION_BROTLI, COMPRESSION_COUNT};
+
+static const struct CompressionFormat
+{
+    const char *option;
+    const char *suffix;
+    int max_level;
+    bool (*compress)(const char *, size_t, int, unsigned, char **, size_t *);
+} compression_formats[COMPRESSION_COUNT] = {
+    [COMPRESSION_GZIP] = {"--gzip", ".gz", 9, gzip_compress},
+    [COMPRESSION_BROTLI] = {"--brotli", ".br", 11, brotli_compress},
+};
+
+// Benchmark statistics
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the values
+static double median(double *values, size_t count)
+{
+    qsort(values, count, sizeof *values, compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Defining CMINIFY_NO_MAIN leaves out the command line interface, so that other programs such as the
+// benchmark can include this file
+#ifndef CMINIFY_NO_MAIN
+
+// Writes a duration in the unit that keeps small files readable, for example `12.3 µs` or `4.567 ms`
+static const char *format_duration(char *buffer, size_t size, double seconds)
+{
+    if (seconds < 1e-3) {
+        snprintf(buffer, size, "%.1f µs", seconds * 1e6);
+    }
+    else if (seconds < 1) {
+        snprintf(buffer, size, "%.3f ms", seconds * 1e3);
+    }
+    else {
+        snprintf(buffer, size, "%.3f s", seconds);
+    }
+    return buffer;
+}
+
+static bool write_compressed_file(const char *filename, const char *content, enum Compression compression,
+    int level, unsigned threads, struct Trace *trace)
+{
+    char *compressed;
+    size_t compressed_length;
+    size_t content_length = strlen(content);
+    double start = trace_start(trace);
+    if (!compression_formats[compression].compress(content, content_length, level, threads, &compressed,
+        &compressed_length))
+    {
+        errno = ENOMEM;
+        perror(filename);
+        return false;
+    }
+    trace_end(trace, TRACE_COMPRESS, start, content_length, compressed_length);
+    start = trace_start(trace);
+    FILE *fp = fopen(filename, "wb");
+    bool success = fp != NULL && fwrite(compressed, 1, compressed_length, fp) == compressed_length;
+    success = (fp == NULL || fclose(fp) == 0) && success;
+    if (!success) {
+        perror(filename);
+    }
+    trace_end(trace, TRACE_WRITE, start, compressed_length, compressed_length);
+    free(compressed);
+    return success;
+}
+
+static unsigned json_hex4_decode(const char *json)
+{
+    // Decodes the 4 hexadecimal digits of a `\u` escape
+
+    unsigned value = 0;
+    for (size_t k = 0; k < 4; ++k) {
+        char digit = tolower((unsigned char) json[k]);
+        value = 16 * value + (isdigit((unsigned char) digit) ? digit - '0' : digit - 'a' + 10);
+    }
+    return value;
+}
+
+static size_t json_string_decode(const char *json, char *result)
+{
+    // Decodes the valid JSON string at `json` into `result`, which must have room for as many bytes as
+    // the string has. Returns the decoded length.
 
-            struct Minification decoded_value = xmlhtml_decode(value, value_length, false);
-            if (decoded_value.result == NULL) {
-                m.error_position = i + decoded_value.error_position;
-                m.result = decoded_value.result;
-                goto error;
-            }
-            if (current_tag_length == sizeof "script" - 1 &&
-                !tagncmp(current_tag, "script", sizeof "script" - 1) &&
-                attribute_length == sizeof "type" - 1 && !tagncmp(attribute, "type", sizeof "type" - 1))
-            {
-                if (!strcmp(decoded_value.result, "application/json+ld")) {
-                    script_type = SCRIPT_TYPE_JSON;
-                }
-                else if (!strcmp(decoded_value.result, "importmap")) {
-                    script_type = SCRIPT_TYPE_JSON;
-                }
-                else if (!strcmp(decoded_value.result, "module")) {
-                    script_type = SCRIPT_TYPE_JAVASCRIPT;
-                }
-                else if (!strcmp(decoded_value.result, "text/javascript")) {
-                    script_type = SCRIPT_TYPE_JAVASCRIPT;
-                }
-                else {
-                    script_type = SCRIPT_TYPE_OTHER;
-                }
-            }
-            free(decoded_value.result);
+    size_t result_length = 0;
+    for (size_t i = 1; json[i] != '"'; ++i) {
+        if (json[i] != '\\') {
+            result[result_length++] = json[i];
             continue;
         }
-        if (!is_xml && syntax_block == SYNTAX_BLOCK_CONTENT && is_whitespace(xmlhtml[i])) {
-            if (current_tag_length == sizeof "pre" - 1 &&
-                !strnicmp(current_tag, "pre", sizeof "pre" - 1))
-            {
-                m.result[result_length++] = xmlhtml[i];
-                i += 1;
-                continue;
-            }
-            while (is_whitespace(xmlhtml[i])) {
-                i += 1;
-            }
-            if (has_whitespace_before_tag && m.result[result_length - 1] == '>') {
-                continue;
-            }
-            m.result[result_length++] = ' ';
+        i += 1;
+        const char *escapes = "\"\"\\\\//b\bf\fn\nr\rt\t";
+        const char *escape = strchr(escapes, json[i]);
+        if (json[i] != 'u') {
+            result[result_length++] = escape[1];
             continue;
         }
-        m.result[result_length++] = xmlhtml[i];
-        i += 1;
+        unsigned code_point = json_hex4_decode(&json[i + 1]);
+        i += 4;
+        if (code_point >= 0xD800 && code_point < 0xDC00 && json[i + 1] == '\\' && json[i + 2] == 'u') {
+            // A surrogate pair encodes one code point of 4 bytes in UTF-8. Its escaped form `\uD83D\uDE00`
+            // is as long as the 4 bytes, so the result still fits.
+
+            unsigned low_surrogate = json_hex4_decode(&json[i + 3]);
+            if (low_surrogate >= 0xDC00 && low_surrogate < 0xE000) {
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                i += 6;
+            }
+        }
+        if (code_point < 0x80) {
+            result[result_length++] = code_point;
+        }
+        else if (code_point < 0x800) {
+            result[result_length++] = 0xC0 | code_point >> 6;
+            result[result_length++] = 0x80 | (code_point & 0x3F);
+        }
+        else if (code_point >= 0x10000) {
+            result[result_length++] = 0xF0 | code_point >> 18;
+            result[result_length++] = 0x80 | ((code_point >> 12) & 0x3F);
+            result[result_length++] = 0x80 | ((code_point >> 6) & 0x3F);
+            result[result_length++] = 0x80 | (code_point & 0x3F);
+        }
+        else {
+            result[result_length++] = 0xE0 | code_point >> 12;
+            result[result_length++] = 0x80 | ((code_point >> 6) & 0x3F);
+            result[result_length++] = 0x80 | (code_point & 0x3F);
+        }
     }
-    return m;
+    return result_length;
+}
 
-error:
-    free(m.result);
-    m.result = NULL;
-    return m;
+static size_t json_string_encode(const char *string, char *result)
+{
+    // Writes `string` as JSON string to `result`, which needs room for 6 bytes per byte of `string` plus
+    // 2. Returns the written length.
+
+    size_t result_length = 0;
+    result[result_length++] = '"';
+    for (const char *c = string; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            result[result_length++] = '\\';
+            result[result_length++] = *c;
+        }
+        else if ((unsigned char) *c < 0x20) {
+            result_length += sprintf(&result[result_length], "\\u%04x", *c);
+        }
+        else {
+            result[result_length++] = *c;
+        }
+    }
+    result[result_length++] = '"';
+    return result_length;
 }
 
-struct Minification minify_xml(const char *xml)
+static void trace_write(FILE *fp, const char *filename, struct Trace *trace)
 {
-    return minify_xmlhtml(xml, true);
+    // Writes the phases of a file as one line of JSON and resets them for the next file
+
+    char *filename_json = malloc(6 * strlen(filename) + 3);
+    if (filename_json == NULL) {
+        return;
+    }
+    filename_json[json_string_encode(filename, filename_json)] = '\0';
+    fprintf(fp, "{\"file\":%s,\"phases\":{", filename_json);
+    free(filename_json);
+    bool first = true;
+    for (size_t k = 0; k < TRACE_PHASE_COUNT; ++k) {
+        const struct TracePhaseStats *stats = &trace->phases[k];
+        if (stats->count > 0) {
+            fprintf(fp, "%s\"%s\":{\"count\":%zu,\"ms\":%.6f,\"bytes_in\":%zu,\"bytes_out\":%zu}",
+                first ? "" : ",", trace_phase_names[k], stats->count, stats->seconds * 1e3, stats->bytes_in,
+                stats->bytes_out);
+            first = false;
+        }
+    }
+    fputs("}}\n", fp);
+    memset(trace->phases, 0, sizeof trace->phases);
 }
 
-struct Minification minify_html(const char *html)
+static bool trace_close(FILE *fp, const char *filename, struct Trace *trace)
 {
-    return minify_xmlhtml(html, false);
+    // Writes the phases of the file, if any, and closes the trace
+
+    if (filename != NULL) {
+        trace_write(fp, filename, trace);
+    }
+    trace_free(trace);
+    return fclose(fp) == 0;
 }
 
-struct LineColumn
+static bool manifest_read(const char *filename, struct Manifest *manifest)
 {
-    size_t line;
-    size_t column;
+    // Reads the manifest file if it exists. It must be a JSON object with strings as values.
+
+    char *content = file_get_content(filename);
+    if (content == NULL) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        perror(filename);
+        return false;
+    }
+    struct Minification m = minify_json(content);
+    if (m.result == NULL) {
+        struct LineColumn line_column = position_to_line_column(content, m.error_position);
+        free(content);
+        fputs(filename, stderr);
+        fputs(": ", stderr);
+        fprintf(stderr, m.error, line_column.line, line_column.column);
+        return false;
+    }
+    free(content);
+
+    // The minified JSON has no whitespace and strings cannot contain unescaped quotes
+
+    bool success = m.result[0] == '{';
+    const char *c = &m.result[1];
+    char *name = malloc(strlen(m.result) + 1), *hashed_name = malloc(strlen(m.result) + 1);
+    if (name == NULL || hashed_name == NULL) {
+        perror(filename);
+        success = false;
+    }
+    while (success && *c == '"') {
+        size_t name_length = json_string_decode(c, name);
+        for (c += 1; *c != '"'; c += 1 + (*c == '\\'));
+        if (c[1] != ':' || c[2] != '"') {
+            success = false;
+            break;
+        }
+        c += 2;
+        size_t hashed_name_length = json_string_decode(c, hashed_name);
+        for (c += 1; *c != '"'; c += 1 + (*c == '\\'));
+        c += 1;
+        if (!manifest_set(manifest, name, name_length, hashed_name, hashed_name_length)) {
+            perror(filename);
+            free(name);
+            free(hashed_name);
+            free(m.result);
+            return false;
+        }
+        c += *c == ',';
+    }
+    if (success && (*c != '}' || c[1] != '\0')) {
+        success = false;
+    }
+    if (!success && name != NULL && hashed_name != NULL) {
+        fputs(filename, stderr);
+        fputs(": The manifest must be a JSON object with strings as values\n", stderr);
+    }
+    free(name);
+    free(hashed_name);
+    free(m.result);
+    return success;
+}
+
+static bool manifest_write(const char *filename, const struct Manifest *manifest)
+{
+    // The manifest is validated and compacted by the JSON minifier before it is written
+
+    size_t json_size = 3;
+    for (size_t k = 0; k < manifest->count; ++k) {
+        json_size += 6 * (strlen(manifest->entries[k].name) + strlen(manifest->entries[k].hashed_name)) + 6;
+    }
+    char *json = malloc(json_size);
+    if (json == NULL) {
+        perror(filename);
+        return false;
+    }
+    size_t json_length = 0;
+    json[json_length++] = '{';
+    for (size_t k = 0; k < manifest->count; ++k) {
+        json_length += json_string_encode(manifest->entries[k].name, &json[json_length]);
+        json[json_length++] = ':';
+        json_length += json_string_encode(manifest->entries[k].hashed_name, &json[json_length]);
+        json[json_length++] = k + 1 < manifest->count ? ',' : '\n';
+    }
+    json_length -= manifest->count > 0;
+    json[json_length++] = '}';
+    json[json_length] = '\0';
+    struct Minification m = minify_json(json);
+    free(json);
+    if (m.result == NULL) {
+        fputs(filename, stderr);
+        fputs(": Cannot write the manifest\n", stderr);
+        return false;
+    }
+    FILE *fp = fopen(filename, "w");
+    bool success = fp != NULL && fputs(m.result, fp) != EOF && fputc('\n', fp) != EOF;
+    success = (fp == NULL || fclose(fp) == 0) && success;
+    if (!success) {
+        perror(filename);
+    }
+    free(m.result);
+    return success;
+}
+
+struct OutputOptions
+{
+    // Directory of the batch mode or NULL to write to the standard output
+    const char *output_directory;
+
+    // Directory that the output paths are relative to, or NULL for the current directory
+    const char *root_directory;
+
+    // Compression level for each compression format or -1 to not write a compressed copy
+    int compression_levels[COMPRESSION_COUNT];
+
+    // Name the output files `name.<content hash>.ext`
+    bool hash_names;
+
+    // JSON file mapping the names to the hashed names, or NULL
+    const char *manifest_filename;
+
+    // JSON Lines file receiving the trace of every input file, or NULL
+    FILE *trace_file;
 };
 
-struct LineColumn position_to_line_column(const char *text, size_t position)
+static bool make_parent_directories(char *path)
 {
-    struct LineColumn lc = {.line = 1, .column = 0};
-    for (size_t i = 0; i <= position; ++i) {
-        if (text[i] == '\n') {
-            lc.line += 1;
-            lc.column = 0;
+    // Creates the missing directories of the file `path` like `mkdir -p`
+
+    for (char *slash = strchr(&path[1], '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        bool success = mkdir(path, 0777) == 0 || errno == EEXIST;
+        if (!success) {
+            perror(path);
         }
-        else {
-            lc.column += 1;
+        *slash = '/';
+        if (!success) {
+            return false;
         }
     }
-    return lc;
+    return true;
+}
+
+static bool minify_batch_file(const char *input_filename, const char *relative_path, enum Format format,
+    const struct MinifyOptions *options, const struct OutputOptions *output_options, struct Manifest *manifest,
+    unsigned threads)
+{
+    // Writes the output to `relative_path` in the output directory
+    double start = trace_start(options->trace);
+    char *input = file_get_content(input_filename);
+    if (input == NULL) {
+        perror(input_filename);
+        return false;
+    }
+    size_t input_length = strlen(input);
+    trace_end(options->trace, TRACE_READ, start, input_length, input_length);
+    start = trace_start(options->trace);
+    struct Minification m = minify_format(input, format, options);
+    trace_end(options->trace, TRACE_MINIFY, start, input_length, m.result == NULL ? 0 : strlen(m.result));
+    if (m.result == NULL) {
+        start = trace_start(options->trace);
+        struct LineColumn line_column = position_to_line_column(input, m.error_position);
+        trace_end(options->trace, TRACE_ERROR_POSITION, start, m.error_position, 0);
+        free(input);
+        fputs(input_filename, stderr);
+        fputs(": ", stderr);
+        fprintf(stderr, m.error, line_column.line, line_column.column);
+        return false;
+    }
+    free(input);
+
+    const char *basename = strrchr(relative_path, '/');
+    basename = basename == NULL ? relative_path : basename + 1;
+    size_t output_filename_size = strlen(output_options->output_directory) + strlen(relative_path) +
+        sizeof "/.0123456789abcdef.xx";
+    char *output_filename = malloc(output_filename_size);
+    if (output_filename == NULL) {
+        free(m.result);
+        perror(input_filename);
+        return false;
+    }
+    bool success = true;
+    size_t output_basename_start = snprintf(output_filename, output_filename_size, "%s/%.*s",
+        output_options->output_directory, (int) (basename - relative_path), relative_path);
+    if (output_options->hash_names) {
+        // The hash goes before the extension. A leading dot does not start an extension.
+
+        const char *extension = strrchr(basename, '.');
+        extension = extension == NULL || extension == basename ? &basename[strlen(basename)] : extension;
+        unsigned long long hash = hash_bytes(m.result, strlen(m.result));
+        snprintf(&output_filename[output_basename_start], output_filename_size - output_basename_start,
+            "%.*s.%016llx%s", (int) (extension - basename), basename, hash, extension);
+        const char *hashed_name = &output_filename[strlen(output_options->output_directory) + 1];
+        if (!manifest_set(manifest, relative_path, strlen(relative_path), hashed_name, strlen(hashed_name))) {
+            perror(input_filename);
+            success = false;
+        }
+    }
+    else {
+        strcpy(&output_filename[output_basename_start], basename);
+    }
+    start = trace_start(options->trace);
+    size_t result_length = strlen(m.result);
+    success = success && make_parent_directories(output_filename);
+    FILE *fp = success ? fopen(output_filename, "w") : NULL;
+    success = fp != NULL && fputs(m.result, fp) != EOF;
+    success = (fp == NULL || fclose(fp) == 0) && success;
+    if (!success) {
+        perror(output_filename);
+    }
+    trace_end(options->trace, TRACE_WRITE, start, result_length, result_length);
+    size_t output_filename_length = strlen(output_filename);
+    for (size_t c = 0; success && c < COMPRESSION_COUNT; ++c) {
+        if (output_options->compression_levels[c] >= 0) {
+            strcpy(&output_filename[output_filename_length], compression_formats[c].suffix);
+            success = write_compressed_file(output_filename, m.result, c, output_options->compression_levels[c],
+                threads, options->trace);
+        }
+    }
+    free(output_filename);
+    free(m.result);
+    return success;
+}
+
+static char *batch_absolute_path(const char *path)
+{
+    // Returns `path` as an absolute path without `.` and `..` segments, empty segments and a trailing
+    // `/`, so that the root directory is the empty string. Symbolic links are not resolved.
+
+    char cwd[4096];
+    if (path[0] != '/' && getcwd(cwd, sizeof cwd) == NULL) {
+        perror(path);
+        return NULL;
+    }
+    size_t path_length = strlen(path);
+    char *absolute = malloc((path[0] == '/' ? 0 : strlen(cwd)) + path_length + 2);
+    if (absolute == NULL) {
+        perror(path);
+        return NULL;
+    }
+    size_t absolute_length = 0;
+    for (int part = path[0] == '/'; part < 2; ++part) {
+        const char *segment = part == 0 ? cwd : path;
+        while (*segment != '\0') {
+            size_t segment_length = strcspn(segment, "/");
+            if (segment_length == sizeof ".." - 1 && !strncmp(segment, "..", segment_length)) {
+                while (absolute_length > 0 && absolute[absolute_length - 1] != '/') {
+                    absolute_length -= 1;
+                }
+                absolute_length -= absolute_length > 0;
+            }
+            else if (segment_length > 0 && (segment_length != 1 || segment[0] != '.')) {
+                absolute[absolute_length++] = '/';
+                memcpy(&absolute[absolute_length], segment, segment_length);
+                absolute_length += segment_length;
+            }
+            segment += segment_length + (segment[segment_length] == '/');
+        }
+    }
+    absolute[absolute_length] = '\0';
+    return absolute;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+static bool batch_relative_paths(const char **filenames, int count, const struct OutputOptions *output_options,
+    char **relative_paths)
+{
+    // Sets the output paths relative to the root directory, which must contain every input. They must not
+    // be shared by several inputs.
+
+    const char *root_directory = output_options->root_directory == NULL ? "." : output_options->root_directory;
+    char *root = batch_absolute_path(root_directory);
+    const char **sorted_paths = malloc(count * sizeof *sorted_paths);
+    bool success = root != NULL && sorted_paths != NULL;
+    if (root != NULL && sorted_paths == NULL) {
+        perror(output_options->output_directory);
+    }
+    size_t root_length = success ? strlen(root) : 0;
+    int k = 0;
+    for (; k < count && success; ++k) {
+        char *absolute = batch_absolute_path(filenames[k]);
+        if (absolute == NULL) {
+            success = false;
+            break;
+        }
+        success = !strncmp(absolute, root, root_length) && absolute[root_length] == '/';
+        if (!success) {
+            free(absolute);
+            fprintf(stderr, "%s: The file is not in the root directory %s, which can be set with --root\n",
+                filenames[k], root_directory);
+            break;
+        }
+        memmove(absolute, &absolute[root_length + 1], strlen(absolute) - root_length);
+        relative_paths[k] = sorted_paths[k] = absolute;
+    }
+    if (success) {
+        qsort(sorted_paths, count, sizeof *sorted_paths, compare_strings);
+        for (int l = 1; l < count && success; ++l) {
+            success = strcmp(sorted_paths[l - 1], sorted_paths[l]) != 0;
+            if (!success) {
+                fprintf(stderr, "%s/%s: Several input files would be written to this file\n",
+                    output_options->output_directory, sorted_paths[l]);
+            }
+        }
+    }
+    if (!success) {
+        while (k > 0) {
+            free(relative_paths[--k]);
+        }
+    }
+    free(sorted_paths);
+    free(root);
+    return success;
+}
+
+static bool minify_batch(const char **input_filenames, int input_count, enum Format format,
+    const struct MinifyOptions *options, const struct OutputOptions *output_options)
+{
+    // Minifies each input file into the output directory, stopping at the first error. The outputs keep
+    // their paths relative to the root directory, so that batches of different formats agree on the paths
+    // in the manifest. For each compression with a level other than -1, a compressed copy with the suffix
+    // of the compression format is written next to it. HTML documents refer to the hashed names of the
+    // manifest, which is updated with the hashed names of this batch.
+
+    char **relative_paths = malloc(input_count * sizeof *relative_paths);
+    if (relative_paths == NULL) {
+        perror(output_options->output_directory);
+        return false;
+    }
+    if (!batch_relative_paths(input_filenames, input_count, output_options, relative_paths)) {
+        free(relative_paths);
+        return false;
+    }
+    struct Manifest manifest = {.entries = NULL};
+    struct MinifyOptions manifest_options = *options;
+    bool success = true;
+    if (output_options->manifest_filename != NULL) {
+        success = manifest_read(output_options->manifest_filename, &manifest);
+        manifest_options.manifest = &manifest;
+    }
+    unsigned threads = options->threads == 0 ? online_processors() : options->threads;
+    for (int k = 0; k < input_count && success; ++k) {
+        manifest_options.document_path = relative_paths[k];
+        success = minify_batch_file(input_filenames[k], relative_paths[k], format, &manifest_options,
+            output_options, &manifest, threads);
+        if (output_options->trace_file != NULL) {
+            trace_write(output_options->trace_file, input_filenames[k], options->trace);
+        }
+    }
+    if (success && output_options->hash_names && output_options->manifest_filename != NULL) {
+        success = manifest_write(output_options->manifest_filename, &manifest);
+    }
+    manifest_free(&manifest);
+    for (int k = 0; k < input_count; ++k) {
+        free(relative_paths[k]);
+    }
+    free(relative_paths);
+    return success;
 }
 
 int main(int argc, const char *argv[])
 {
     bool benchmark = false;
+    bool benchmark_json = false;
+    unsigned long repeat = 0;
+    unsigned long warmup = 0;
+    bool stream = false;
     bool print_usage = false;
+    int compression_count = 0;
+    struct MinifyOptions options = default_options;
+    options.threads = 0;
+    struct OutputOptions output_options = {
+        .output_directory = NULL, .root_directory = NULL, .compression_levels = {-1, -1}, .hash_names = false,
+        .manifest_filename = NULL, .trace_file = NULL
+    };
+    const char *trace_filename = NULL;
+    struct Trace trace;
     const char *format_str = NULL;
-    const char *input_filename = NULL;
-    enum {FORMAT_JS, FORMAT_CSS, FORMAT_XML, FORMAT_HTML, FORMAT_JSON} format;
+    const char **input_filenames = malloc(argc * sizeof *input_filenames);
+    int input_count = 0;
+    enum Format format;
 
+    if (input_filenames == NULL) {
+        perror(argv[0]);
+        return EXIT_FAILURE;
+    }
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--benchmark")) {
             benchmark = true;
         }
+        else if (!strcmp(argv[i], "--json")) {
+            benchmark_json = true;
+        }
+        else if ((!strcmp(argv[i], "--repeat") || !strcmp(argv[i], "--warmup")) && i + 1 < argc) {
+            bool is_repeat = !strcmp(argv[i], "--repeat");
+            char *end;
+            unsigned long runs = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || runs > 1000000 || is_repeat && runs == 0) {
+                fprintf(stderr, "Invalid number of runs: %s\n", argv[i]);
+                print_usage = true;
+                break;
+            }
+            *(is_repeat ? &repeat : &warmup) = runs;
+        }
+        else if (!strcmp(argv[i], "--stream")) {
+            stream = true;
+        }
+        else if (!strcmp(argv[i], "--omit-optional-tags")) {
+            options.omit_optional_tags = true;
+        }
+        else if (!strcmp(argv[i], "--canonical-numbers")) {
+            options.canonicalize_json_numbers = true;
+        }
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            output_options.output_directory = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--root") && i + 1 < argc) {
+            output_options.root_directory = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--hash-names")) {
+            output_options.hash_names = true;
+        }
+        else if (!strcmp(argv[i], "--manifest") && i + 1 < argc) {
+            output_options.manifest_filename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_filename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            char *end;
+            unsigned long threads = strtoul(argv[++i], &end, 10);
+            if (*end != '\0' || threads == 0 || threads > 1024) {
+                fprintf(stderr, "Invalid number of threads: %s\n", argv[i]);
+                print_usage = true;
+                break;
+            }
+            options.threads = threads;
+        }
+        else if ((!strcmp(argv[i], "--gzip") || !strcmp(argv[i], "--brotli")) && i + 1 < argc) {
+            enum Compression compression = strcmp(argv[i], "--gzip") ? COMPRESSION_BROTLI : COMPRESSION_GZIP;
+            char *end;
+            long level = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || level < 0 || level > compression_formats[compression].max_level) {
+                fprintf(stderr, "Invalid %s level: %s\n", compression_formats[compression].option, argv[i]);
+                print_usage = true;
+                break;
+            }
+            compression_count += output_options.compression_levels[compression] < 0;
+            output_options.compression_levels[compression] = level;
+        }
         else if (format_str == NULL) {
             format_str = argv[i];
         }
-        else if (input_filename == NULL) {
-            input_filename = argv[i];
-        }
         else {
-            print_usage = true;
-            break;
+            input_filenames[input_count++] = argv[i];
         }
     }
-    if (format_str == NULL || input_filename == NULL) {
+    if (format_str == NULL || input_count == 0 || output_options.output_directory == NULL && input_count > 1) {
         print_usage = true;
     }
     else if (!strcmp(format_str, "js")) {
@@ -2370,57 +6528,230 @@ int main(int argc, const char *argv[])
         fprintf(stderr, "Unsupported input format: %s\n", format_str);
         print_usage = true;
     }
+    if (!print_usage && stream && (format != FORMAT_XML || benchmark || output_options.output_directory != NULL ||
+        compression_count > 0))
+    {
+        fputs("--stream is only supported for XML and without --benchmark, --batch, --gzip and --brotli\n",
+            stderr);
+        print_usage = true;
+    }
+    if (!print_usage && options.omit_optional_tags && format != FORMAT_HTML) {
+        fputs("--omit-optional-tags is only supported for HTML\n", stderr);
+        print_usage = true;
+    }
+    if (!print_usage && compression_count > 1 && output_options.output_directory == NULL && !benchmark) {
+        fputs("Only one of --gzip and --brotli can compress the standard output\n", stderr);
+        print_usage = true;
+    }
+    if (!print_usage && (output_options.hash_names || output_options.manifest_filename != NULL ||
+        output_options.root_directory != NULL) && output_options.output_directory == NULL)
+    {
+        fputs("--root, --hash-names and --manifest are only supported with --batch\n", stderr);
+        print_usage = true;
+    }
+    if (!print_usage && (repeat > 0 || warmup > 0 || benchmark_json) && !benchmark) {
+        fputs("--repeat, --warmup and --json are only supported with --benchmark\n", stderr);
+        print_usage = true;
+    }
+    if (!print_usage && benchmark && output_options.output_directory != NULL) {
+        fputs("--batch cannot be combined with --benchmark\n", stderr);
+        print_usage = true;
+    }
+    if (!print_usage && trace_filename != NULL && (benchmark || stream)) {
+        fputs("--trace cannot be combined with --benchmark and --stream\n", stderr);
+        print_usage = true;
+    }
 
     if (print_usage) {
+        free(input_filenames);
         fputs("Usage: ", stderr);
         fputs(argv[0], stderr);
-        fputs(" <css|js|xml|html|json> <input file|-> [--benchmark]\n", stderr);
+        fputs(" <css|js|xml|html|json> <input file|-> [--benchmark [--repeat N] [--warmup N] [--json]] [--stream]"
+            " [--threads N] [--omit-optional-tags] [--canonical-numbers] [--gzip LEVEL]"
+            " [--brotli QUALITY] [--trace FILE]\n", stderr);
+        fputs("       ", stderr);
+        fputs(argv[0], stderr);
+        fputs(" <css|js|xml|html|json> --batch <output directory> <input files...> [--root DIRECTORY]"
+            " [--threads N] [--omit-optional-tags] [--canonical-numbers] [--gzip LEVEL]"
+            " [--brotli QUALITY] [--hash-names] [--manifest FILE] [--trace FILE]\n", stderr);
         return EXIT_FAILURE;
     }
 
+    if (trace_filename != NULL) {
+        output_options.trace_file = fopen(trace_filename, "w");
+        if (output_options.trace_file == NULL) {
+            perror(trace_filename);
+            free(input_filenames);
+            return EXIT_FAILURE;
+        }
+        trace_init(&trace);
+        options.trace = &trace;
+    }
+
+    if (output_options.output_directory != NULL) {
+        // Documents of a batch typically share scripts and stylesheets, which are minified only once
+        struct InlineCache cache;
+        inline_cache_init(&cache);
+        options.cache = &cache;
+        bool success = minify_batch(input_filenames, input_count, format, &options, &output_options);
+        inline_cache_free(&cache);
+        free(input_filenames);
+        if (output_options.trace_file != NULL && !trace_close(output_options.trace_file, NULL, &trace)) {
+            perror(trace_filename);
+            success = false;
+        }
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const char *input_filename = input_filenames[0];
+    free(input_filenames);
+
+    if (stream) {
+        FILE *fp = stdin;
+        if (strcmp(input_filename, "-")) {
+            fp = fopen(input_filename, "r");
+            if (fp == NULL) {
+                perror(input_filename);
+                return EXIT_FAILURE;
+            }
+        }
+        struct Minification m;
+        struct LineColumn line_column;
+        bool success = minify_xml_stream(fp, stdout, &m, &line_column);
+        fclose(fp);
+        if (!success) {
+            fprintf(stderr, m.error, line_column.line, line_column.column);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    double start = trace_start(options.trace);
     char *input = file_get_content(input_filename);
     if (input == NULL) {
         perror(input_filename);
+        if (output_options.trace_file != NULL) {
+            trace_close(output_options.trace_file, NULL, &trace);
+        }
         return EXIT_FAILURE;
     }
-    struct Minification m;
-    switch (format) {
-    case FORMAT_JS:
-        m = minify_js(input);
-        break;
-    case FORMAT_CSS:
-        m = minify_css(input);
-        break;
-    case FORMAT_XML:
-        m = minify_xml(input);
-        break;
-    case FORMAT_HTML:
-        m = minify_html(input);
-        break;
-    case FORMAT_JSON:
-    default:
-        m = minify_json(input);
-        break;
+    size_t input_length = strlen(input);
+    trace_end(options.trace, TRACE_READ, start, input_length, input_length);
+    repeat = repeat == 0 ? 1 : repeat;
+    double *seconds = benchmark ? malloc(repeat * sizeof *seconds) : NULL;
+    if (benchmark && seconds == NULL) {
+        perror(input_filename);
+        free(input);
+        return EXIT_FAILURE;
     }
+    start = now_seconds();
+    struct Minification m = minify_format(input, format, &options);
+    double first_seconds = now_seconds() - start;
+    trace_end(options.trace, TRACE_MINIFY, start, input_length, m.result == NULL ? 0 : strlen(m.result));
     if (m.result == NULL) {
+        start = trace_start(options.trace);
         struct LineColumn line_column = position_to_line_column(input, m.error_position);
+        trace_end(options.trace, TRACE_ERROR_POSITION, start, m.error_position, 0);
         free(input);
+        free(seconds);
         fprintf(stderr, m.error, line_column.line, line_column.column);
         free(m.result);
+        if (output_options.trace_file != NULL) {
+            trace_close(output_options.trace_file, input_filename, &trace);
+        }
         return EXIT_FAILURE;
     }
     if (benchmark) {
+        // The first run is timed unless warm-up runs are requested, in which case it is the first warm-up run
+        size_t runs = 0;
+        if (warmup == 0) {
+            seconds[runs++] = first_seconds;
+        }
+        for (unsigned long k = 1; k < warmup; ++k) {
+            free(minify_format(input, format, &options).result);
+        }
+        while (runs < repeat) {
+            start = now_seconds();
+            struct Minification run = minify_format(input, format, &options);
+            seconds[runs++] = now_seconds() - start;
+            free(run.result);
+        }
         size_t strlen_input = strlen(input);
         size_t strlen_minification = strlen(m.result);
-        printf(
-            "Reduced the size by %.1f%% from %zu to %zu bytes\n",
-            100.0 - 100.0 * strlen_minification / strlen_input, strlen_input, strlen_minification
-        );
+        double median_seconds = median(seconds, repeat);
+        // Nearest-rank percentile
+        double p99_seconds = seconds[(99 * repeat + 99) / 100 - 1];
+        if (benchmark_json) {
+            printf("{\"format\":\"%s\",\"input_bytes\":%zu,\"output_bytes\":%zu,\"reduction_percent\":%.2f,"
+                "\"runs\":%lu,\"warmup_runs\":%lu,\"min_ms\":%.6f,\"median_ms\":%.6f,\"p99_ms\":%.6f,"
+                "\"megabytes_per_second\":%.3f", format_str, strlen_input, strlen_minification,
+                100.0 - 100.0 * strlen_minification / strlen_input, repeat, warmup, seconds[0] * 1e3,
+                median_seconds * 1e3, p99_seconds * 1e3, strlen_input / median_seconds / 1e6);
+        }
+        else {
+            printf(
+                "Reduced the size by %.1f%% from %zu to %zu bytes\n",
+                100.0 - 100.0 * strlen_minification / strlen_input, strlen_input, strlen_minification
+            );
+            char min_string[32], median_string[32], p99_string[32];
+            printf("Minified %lu time(s) after %lu warm-up run(s): min %s, median %s, p99 %s, %.1f MB/s\n", repeat,
+                warmup, format_duration(min_string, sizeof min_string, seconds[0]),
+                format_duration(median_string, sizeof median_string, median_seconds),
+                format_duration(p99_string, sizeof p99_string, p99_seconds), strlen_input / median_seconds / 1e6);
+        }
+        free(seconds);
     }
-    else {
+    else if (compression_count == 0) {
+        start = trace_start(options.trace);
         fputs(m.result, stdout);
+        trace_end(options.trace, TRACE_WRITE, start, strlen(m.result), strlen(m.result));
+    }
+    unsigned threads = options.threads == 0 ? online_processors() : options.threads;
+    for (size_t c = 0; c < COMPRESSION_COUNT; ++c) {
+        char *compressed;
+        size_t compressed_length;
+        if (output_options.compression_levels[c] < 0) {
+            continue;
+        }
+        start = trace_start(options.trace);
+        if (!compression_formats[c].compress(m.result, strlen(m.result), output_options.compression_levels[c],
+            threads, &compressed, &compressed_length))
+        {
+            errno = ENOMEM;
+            perror(input_filename);
+            free(m.result);
+            free(input);
+            if (output_options.trace_file != NULL) {
+                trace_close(output_options.trace_file, NULL, &trace);
+            }
+            return EXIT_FAILURE;
+        }
+        trace_end(options.trace, TRACE_COMPRESS, start, strlen(m.result), compressed_length);
+        if (benchmark_json) {
+            printf(",\"%s_level\":%d,\"%s_bytes\":%zu", &compression_formats[c].option[2],
+                output_options.compression_levels[c], &compression_formats[c].option[2], compressed_length);
+        }
+        else if (benchmark) {
+            printf("Compressed with %s %d to %zu bytes\n", compression_formats[c].option,
+                output_options.compression_levels[c], compressed_length);
+        }
+        else {
+            start = trace_start(options.trace);
+            fwrite(compressed, 1, compressed_length, stdout);
+            trace_end(options.trace, TRACE_WRITE, start, compressed_length, compressed_length);
+        }
+        free(compressed);
+    }
+    if (benchmark_json) {
+        puts("}");
     }
     free(m.result);
     free(input);
+    if (output_options.trace_file != NULL && !trace_close(output_options.trace_file, input_filename, &trace)) {
+        perror(trace_filename);
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
+
+#endif
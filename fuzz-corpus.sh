@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+
+# Collects the inputs that the test scripts pass to cminify into fuzz-corpus/<format>/, as seed corpus for
+# the fuzzers. The test scripts run in a temporary directory, where build/cminify saves its input before
+# running the real build/cminify.
+
+set -e
+repository="$(cd "$(dirname "$0")" && pwd)"
+work_dir="$(mktemp -d)"
+trap 'rm -rf "$work_dir"' EXIT
+mkdir -p "$work_dir/build"
+for format in css js json xml html; do
+	mkdir -p "$repository/fuzz-corpus/$format"
+	cp "$repository/test-$format.sh" "$work_dir/"
+done
+
+cat > "$work_dir/build/cminify" <<WRAPPER
+#!/usr/bin/env bash
+format="\$1"
+input="\$2"
+corpus="$repository/fuzz-corpus/\$format"
+if [ -d "\$corpus" ] && [ "\$input" = - ]; then
+	input="$work_dir/stdin"
+	cat > "\$input"
+	shift 2
+	set -- "\$format" "\$input" "\$@"
+fi
+# Large inputs slow the fuzzers down
+if [ -d "\$corpus" ] && [ -f "\$input" ] && [ "\$(wc -c < "\$input")" -le 65536 ]; then
+	cp "\$input" "\$corpus/\$(cksum < "\$input" | cut -d ' ' -f 1)"
+fi
+exec "$repository/build/cminify" "\$@"
+WRAPPER
+chmod +x "$work_dir/build/cminify"
+
+cd "$work_dir"
+for format in css js json xml html; do
+	bash "test-$format.sh" > /dev/null
+done
+for format in css js json xml html; do
+	echo "$format: $(ls "$repository/fuzz-corpus/$format" | wc -l) inputs"
+done
@@ -0,0 +1,355 @@
+// Fuzzing entry points for the minifiers
+//
+// The format is chosen at compile time with -DFUZZ_FORMAT=FORMAT_CSS, FORMAT_JS, FORMAT_JSON, FORMAT_XML or
+// FORMAT_HTML. Built with `clang -fsanitize=fuzzer`, LLVMFuzzerTestOneInput is the libFuzzer entry point,
+// which AFL++ can use, too. With FUZZ_STANDALONE, this file has its own main that needs no clang: it runs
+// the given corpus files and random mutations of them, each with a timeout to detect hangs. Build both
+// with `-fsanitize=address,undefined` to catch out-of-bounds writes into the results. XML and HTML are
+// also fuzzed with -DFUZZ_THREADS=4 -DINLINE_PARALLEL_MIN_SIZE=0, which minifies the inline blocks of every
+// document on a thread pool.
+
+#include <fcntl.h>
+#include <signal.h>
+
+#define CMINIFY_NO_MAIN
+#include "cminify.c"
+
+#ifndef FUZZ_FORMAT
+#error "FUZZ_FORMAT must be defined as the format to fuzz, for example -DFUZZ_FORMAT=FORMAT_CSS"
+#endif
+
+#ifndef FUZZ_THREADS
+#define FUZZ_THREADS 1
+#endif
+
+static void fuzz_minify(const char *input, const struct MinifyOptions *options)
+{
+    struct Minification m = minify_format(input, FUZZ_FORMAT, options);
+    if (m.result == NULL) {
+        // Errors must point into the input
+        if (m.error_position > strlen(input)) {
+            fprintf(stderr, "Error position %zu is beyond the input of length %zu\n", m.error_position,
+                strlen(input));
+            abort();
+        }
+        position_to_line_column(input, m.error_position);
+    }
+    free(m.result);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // The minifiers take terminated strings, so the input ends at the first null byte
+
+    char *input = malloc(size + 1);
+    if (input == NULL) {
+        return 0;
+    }
+    memcpy(input, data, size);
+    input[size] = '\0';
+    struct MinifyOptions options = default_options;
+    options.threads = FUZZ_THREADS;
+    fuzz_minify(input, &options);
+    if (FUZZ_FORMAT == FORMAT_HTML) {
+        options.omit_optional_tags = true;
+        fuzz_minify(input, &options);
+    }
+    if (FUZZ_FORMAT == FORMAT_JSON) {
+        options.canonicalize_json_numbers = true;
+        fuzz_minify(input, &options);
+    }
+    free(input);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#define FUZZ_MAX_LENGTH 65536
+
+// Syntax that the random mutations insert
+static const char *const fuzz_tokens[] = {
+    "<", ">", "</", "/>", "<!--", "-->", "<![CDATA[", "]]>", "<?", "?>", "<script>", "</script", "<style>",
+    "</style", "<p>", "<li>", "<table>", "&amp;", "&#", "&", "=", "\"", "'", "`", "${", "}", "{", "(", ")", "[",
+    "]", "/*", "*/", "//", "/", "\\", "\\\n", "\n", " ", ";", ":", ",", "+", "-", ".", "@media", "url(", "!",
+    "#fff", "0.50px", "1e5", "-0", "\\u00", "true", "null", "if", "else", "do", "while", "function", "=>",
+    "return", "style=", "onclick=", "type=importmap",
+};
+
+static char **corpus;
+static size_t corpus_count;
+static size_t corpus_capacity;
+
+// The current input, written to a file when the run crashes or hangs
+static char fuzz_input[FUZZ_MAX_LENGTH + 1];
+static size_t fuzz_input_length;
+static const char *fuzz_crash_filename = "fuzz-crash.txt";
+
+static uint64_t fuzz_random_state = 1;
+
+static uint64_t fuzz_random(void)
+{
+    fuzz_random_state ^= fuzz_random_state >> 12;
+    fuzz_random_state ^= fuzz_random_state << 25;
+    fuzz_random_state ^= fuzz_random_state >> 27;
+    return fuzz_random_state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t fuzz_random_below(size_t bound)
+{
+    return bound == 0 ? 0 : (fuzz_random() >> 16) % bound;
+}
+
+static void fuzz_save_input(void)
+{
+    // Only uses async-signal-safe functions, because it runs in signal handlers
+
+    int fd = open(fuzz_crash_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ssize_t written = write(fd, fuzz_input, fuzz_input_length);
+        (void) written;
+        close(fd);
+    }
+}
+
+static void fuzz_timeout(int signal_number)
+{
+    (void) signal_number;
+    static const char message[] = "Timeout: the input is saved for reproduction\n";
+    ssize_t written = write(STDERR_FILENO, message, sizeof message - 1);
+    (void) written;
+    fuzz_save_input();
+    _exit(EXIT_FAILURE);
+}
+
+static void fuzz_abort(int signal_number)
+{
+    fuzz_save_input();
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+// UndefinedBehaviorSanitizer does not run the death callback, but can abort
+const char *__ubsan_default_options(void)
+{
+    return "print_stacktrace=1:abort_on_error=1";
+}
+
+static bool corpus_add_file(const char *filename)
+{
+    char *content = file_get_content(filename);
+    if (content == NULL) {
+        perror(filename);
+        return false;
+    }
+    if (corpus_count == corpus_capacity) {
+        corpus_capacity = corpus_capacity == 0 ? 64 : 2 * corpus_capacity;
+        char **corpus_realloc = realloc(corpus, corpus_capacity * sizeof *corpus);
+        if (corpus_realloc == NULL) {
+            free(content);
+            perror(filename);
+            return false;
+        }
+        corpus = corpus_realloc;
+    }
+    content[strnlen(content, FUZZ_MAX_LENGTH)] = '\0';
+    corpus[corpus_count++] = content;
+    return true;
+}
+
+static bool corpus_add(const char *path)
+{
+    // Adds a file or all files of a directory
+
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        perror(path);
+        return false;
+    }
+    if (!S_ISDIR(path_stat.st_mode)) {
+        return corpus_add_file(path);
+    }
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        perror(path);
+        return false;
+    }
+    bool success = true;
+    struct dirent *entry;
+    while (success && (entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        size_t filename_size = strlen(path) + strlen(entry->d_name) + 2;
+        char *filename = malloc(filename_size);
+        if (filename == NULL) {
+            success = false;
+            break;
+        }
+        snprintf(filename, filename_size, "%s/%s", path, entry->d_name);
+        success = corpus_add_file(filename);
+        free(filename);
+    }
+    closedir(directory);
+    return success;
+}
+
+static void fuzz_mutate(void)
+{
+    // Starts from a random corpus entry and applies a few random mutations
+
+    const char *base = corpus_count == 0 ? "" : corpus[fuzz_random_below(corpus_count)];
+    fuzz_input_length = strlen(base);
+    memcpy(fuzz_input, base, fuzz_input_length);
+    size_t mutations = 1 + fuzz_random_below(8);
+    for (size_t k = 0; k < mutations; ++k) {
+        size_t position = fuzz_random_below(fuzz_input_length + 1);
+        size_t length = fuzz_random_below(fuzz_input_length - position + 1);
+        const char *insertion = NULL;
+        size_t insertion_length = 0;
+        switch (fuzz_random_below(6)) {
+        case 0:
+            // Replacing a byte
+            if (position < fuzz_input_length) {
+                fuzz_input[position] = 1 + fuzz_random_below(255);
+            }
+            break;
+        case 1:
+            // Deleting a range
+            memmove(&fuzz_input[position], &fuzz_input[position + length], fuzz_input_length - position - length);
+            fuzz_input_length -= length;
+            break;
+        case 2:
+            // Duplicating a range, possibly many times
+            insertion = &fuzz_input[position];
+            insertion_length = length > 64 ? 64 : length;
+            break;
+        case 3:
+            // Splicing in a part of another corpus entry
+            if (corpus_count > 0) {
+                insertion = corpus[fuzz_random_below(corpus_count)];
+                size_t other_length = strlen(insertion);
+                size_t start = fuzz_random_below(other_length + 1);
+                insertion += start;
+                insertion_length = fuzz_random_below(other_length - start + 1);
+            }
+            break;
+        case 4:
+            // Truncating
+            fuzz_input_length = position;
+            break;
+        default:
+            insertion = fuzz_tokens[fuzz_random_below(sizeof fuzz_tokens / sizeof *fuzz_tokens)];
+            insertion_length = strlen(insertion);
+        }
+        if (insertion == NULL) {
+            continue;
+        }
+        size_t repetitions = fuzz_random_below(4) == 0 ? 1 + fuzz_random_below(64) : 1;
+        for (size_t r = 0; r < repetitions; ++r) {
+            if (fuzz_input_length + insertion_length > FUZZ_MAX_LENGTH) {
+                break;
+            }
+            // The insertion may point into the input itself
+            char buffer[64];
+            const char *source = insertion;
+            if (insertion >= fuzz_input && insertion < &fuzz_input[FUZZ_MAX_LENGTH]) {
+                memcpy(buffer, insertion, insertion_length);
+                source = buffer;
+            }
+            size_t insert_position = fuzz_random_below(fuzz_input_length + 1);
+            memmove(&fuzz_input[insert_position + insertion_length], &fuzz_input[insert_position],
+                fuzz_input_length - insert_position);
+            memcpy(&fuzz_input[insert_position], source, insertion_length);
+            fuzz_input_length += insertion_length;
+        }
+    }
+    fuzz_input[fuzz_input_length] = '\0';
+    fuzz_input_length = strlen(fuzz_input);
+}
+
+static void fuzz_run(unsigned timeout_seconds)
+{
+    alarm(timeout_seconds);
+    LLVMFuzzerTestOneInput((const uint8_t *) fuzz_input, fuzz_input_length);
+    alarm(0);
+}
+
+int main(int argc, const char *argv[])
+{
+    unsigned long runs = 0;
+    unsigned long timeout_seconds = 2;
+    bool print_usage = false;
+    for (int i = 1; i < argc && !print_usage; ++i) {
+        if ((!strcmp(argv[i], "--runs") || !strcmp(argv[i], "--seed") || !strcmp(argv[i], "--timeout")) &&
+            i + 1 < argc)
+        {
+            char *end;
+            unsigned long value = strtoul(argv[i + 1], &end, 10);
+            print_usage = *end != '\0' || end == argv[i + 1];
+            if (!strcmp(argv[i], "--runs")) {
+                runs = value;
+            }
+            else if (!strcmp(argv[i], "--seed")) {
+                fuzz_random_state = value == 0 ? 1 : value;
+            }
+            else {
+                timeout_seconds = value;
+            }
+            i += 1;
+        }
+        else if (!strcmp(argv[i], "--crash-file") && i + 1 < argc) {
+            fuzz_crash_filename = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            print_usage = true;
+        }
+        else if (!corpus_add(argv[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (print_usage) {
+        fputs("Usage: ", stderr);
+        fputs(argv[0], stderr);
+        fputs(" [--runs N] [--seed N] [--timeout SECONDS] [--crash-file FILE] <corpus files or directories...>\n",
+            stderr);
+        return EXIT_FAILURE;
+    }
+    signal(SIGALRM, fuzz_timeout);
+    signal(SIGABRT, fuzz_abort);
+#ifdef __SANITIZE_ADDRESS__
+    __sanitizer_set_death_callback(fuzz_save_input);
+#endif
+
+    // The corpus runs first as it is, then the random mutations of it
+
+    double start = now_seconds();
+    size_t total_length = 0;
+    for (size_t k = 0; k < corpus_count; ++k) {
+        fuzz_input_length = strlen(corpus[k]);
+        memcpy(fuzz_input, corpus[k], fuzz_input_length + 1);
+        total_length += fuzz_input_length;
+        fuzz_run(timeout_seconds);
+    }
+    for (unsigned long k = 0; k < runs; ++k) {
+        fuzz_mutate();
+        total_length += fuzz_input_length;
+        fuzz_run(timeout_seconds);
+    }
+    double seconds = now_seconds() - start;
+    printf("%zu corpus inputs and %lu mutations in %.1f s: %.0f inputs/s, %.2f MB/s\n", corpus_count, runs,
+        seconds, (corpus_count + runs) / seconds, total_length / seconds / 1e6);
+    for (size_t k = 0; k < corpus_count; ++k) {
+        free(corpus[k]);
+    }
+    free(corpus);
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#!/usr/bin/env sh
+
+# Minifying a pathological input 16 times as large must take at most about 16 times as long. Quadratic
+# behavior would take 256 times as long, so the bound leaves room for noise on busy machines.
+
+small_size=524288
+large_size=$((16 * small_size))
+
+generate()
+{
+	# Writes prefix, repeated open, middle, repeated close and suffix, with as many repetitions as fit
+	# into the size
+	count=$(($1 / (${#3} + ${#5} + 1)))
+	printf '%s' "$2"
+	yes "$3" | head -n "$count" | tr -d '\n'
+	printf '%s' "$4"
+	if [ -n "$5" ]; then
+		yes "$5" | head -n "$count" | tr -d '\n'
+	fi
+	printf '%s' "$6"
+}
+
+median_ms()
+{
+	# The first run validates the input, the median of three more runs is taken
+	result="$(./build/cminify "$1" "$2" --benchmark --warmup 1 --repeat 3 --json)"
+	if [ "$?" != "0" ]; then
+		echo "Error: failed to minify $1:"
+		head -c 200 "$2"
+		echo
+		return 1
+	fi
+	echo "$result" | sed 's/.*"median_ms":\([0-9.]*\).*/\1/'
+}
+
+assert_linear()
+{
+	description="$1"
+	format="$2"
+	shift 2
+	input="$(mktemp)"
+	generate "$small_size" "$@" > "$input"
+	small_ms="$(median_ms "$format" "$input")" || exit 1
+	generate "$large_size" "$@" > "$input"
+	large_ms="$(median_ms "$format" "$input")" || exit 1
+	rm "$input"
+	if ! awk "BEGIN { exit !($large_ms <= 48 * $small_ms + 50) }"; then
+		echo "Error: $description does not scale linearly: $small_ms ms for $small_size bytes," \
+			"$large_ms ms for $large_size bytes"
+		exit 1
+	fi
+}
+
+assert_linear 'deeply nested JSON arrays' json '' '[' '' ']' ''
+assert_linear 'deeply nested JSON objects' json '' '{"a":' '1' '}' ''
+assert_linear 'a huge JSON string' json '"' 'abcdefgh' '"' '' ''
+assert_linear 'a long run of JSON escapes' json '"' '\\' '"' '' ''
+
+assert_linear 'deeply nested JS round brackets' js '' '(' '' ')' ''
+assert_linear 'deeply nested JS blocks' js '' '{' '' '}' ''
+assert_linear 'comments after a JS identifier' js 'a' ' /**/ ' 'b' '' ''
+assert_linear 'a megabyte JS comment' js 'a /*' 'abcdefgh' '*/ b' '' ''
+assert_linear 'a long run of JS string escapes' js '"' '\\' '"' '' ''
+assert_linear 'a huge JS template literal' js '`' 'abcdefgh' '`' '' ''
+assert_linear 'many JS keywords' js '' 'if(1);else ' ';' '' ''
+
+assert_linear 'a megabyte CSS comment' css 'a{b:c}/*' 'abcdefgh' '*/' '' ''
+assert_linear 'deeply nested CSS at-rules' css '' '@media x{' '' '}' ''
+assert_linear 'deeply nested CSS functions' css 'a{b:' 'f(' '' ')' '}'
+assert_linear 'a long run of CSS string escapes' css 'a{content:"' '\\' '"}' '' ''
+
+assert_linear 'thousands of HTML attributes' html '<a' ' x=1' '>' '' ''
+assert_linear 'a megabyte HTML comment' html '<p><!--' 'abcdefgh' '-->' '' ''
+assert_linear 'many `<` in an inline script' html '<script>' 'a<b;' '</script>' '' ''
+assert_linear 'deeply nested HTML elements' html '' '<div>' '' '</div>' ''
+assert_linear 'a huge style attribute' html '<a style="' 'a:b;' '">' '' ''
+
+assert_linear 'many `]` in an XML inline script' xml '<svg><script>' ']' '</script></svg>' '' ''
+assert_linear 'deeply nested XML elements' xml '' '<a>' '' '</a>' ''
+assert_linear 'many XML entities' xml '<a>' '&amp;' '</a>' '' ''
+
+echo 'Passed all tests'
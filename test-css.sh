@@ -16,6 +16,16 @@ assert()
 	fi
 }
 
+assert_error()
+{
+	error="$(printf '%s' "$1" | ./build/cminify css - 2>&1 > /dev/null)"
+	if [ "$?" != "1" ] || [ "${error#*, column }" = "$error" ]; then
+		echo 'Error: expected a syntax error on:'
+		echo "$1"
+		exit 1
+	fi
+}
+
 input='/*! do not remove */'
 expected='/*! do not remove */'
 assert "$expected" "$input"
@@ -24,6 +34,10 @@ input='a /**/ + /*o/*o*/ a  #b { c : 1px/**//**/1px;/**/; ;;d:"/* "  3 ;; }'
 expected='a+a #b{c:1px 1px;d:"/* " 3}'
 assert "$expected" "$input"
 
+input='a/*!x*/b{c:d/*!y*/e}'
+expected='a/*!x*/b{c:d/*!y*/e}'
+assert "$expected" "$input"
+
 input='@import url(/*o);'
 expected='@import url(/*o);'
 assert "$expected" "$input"
@@ -60,4 +74,37 @@ input='a\{b{}'
 expected='a\{b{}'
 assert "$expected" "$input"
 
+input='#aabbcc.white { color : #AABBCC ; background : url(#aabbcc) #aabbccff ; border : 1px solid white }'
+expected='#aabbcc.white{color:#abc;background:url(#aabbcc) #abc;border:1px solid #fff}'
+assert "$expected" "$input"
+
+input='a{ color:rgb( 255 , 0 , 0 ); fill:rgba(0 128 0 / 100%); --x:white; animation-name:tan; content:"#fff" }'
+expected='a{color:red;fill:green;--x:white;animation-name:tan;content:"#fff"}'
+assert "$expected" "$input"
+
+input='a{ filter:progid:DXImageTransform.Microsoft.gradient( startColorstr=#FFaabbcc , endColorstr=#80000000 ) }'
+expected='a{filter:progid:DXImageTransform.Microsoft.gradient( startColorstr=#FFaabbcc,endColorstr=#80000000 )}'
+assert "$expected" "$input"
+
+input='a{ filter:progid:DXImageTransform.Microsoft.Alpha( Color=#FFFFFF ); color:#FFFFFF }'
+expected='a{filter:progid:DXImageTransform.Microsoft.Alpha( Color=#FFFFFF );color:#fff}'
+assert "$expected" "$input"
+
+input='a { margin : 0.50em -0.5px +1.50em 2.0px ; x : 1E+03 1e-03 0.0e5 007 0px 0% 0s ; width : calc( 100% - 0px ) }'
+expected='a{margin:.5em -.5px 1.5em 2px;x:1e3 1e-3 0 7 0 0% 0s;width:calc( 100% - 0px )}'
+assert "$expected" "$input"
+
+input='.col-0.active , h0.x , li:nth-child( 2n+1 ) { flex : 1 1 0px }'
+expected='.col-0.active,h0.x,li:nth-child(2n+1){flex:1 1 0px}'
+assert "$expected" "$input"
+
+input='@font-face { unicode-range : U+1E00-1E9F , U+0E01-0E5B , u+0025-00FF ; font-weight : 0400 }'
+expected='@font-face{unicode-range:U+1E00-1E9F,U+0E01-0E5B,u+0025-00FF;font-weight:400}'
+assert "$expected" "$input"
+
+# Inputs found by the fuzzer, which read outside the input or the result
+
+assert_error '/* a'
+assert_error 'a{b:c\'
+
 echo 'Passed all tests'
@@ -2,7 +2,7 @@
 
 assert()
 {
-	result="$(echo -e "$2" | ./build/cminify html -)"
+	result="$(echo -e "$2" | ./build/cminify html - $3)"
 	if [ "$?" != "0" ]; then
 		echo 'Crashed on:'
 		echo "$2"
@@ -44,6 +44,14 @@ input='<script type="text&sol;javascript"> { "key" : true } </script>'
 expected='<script type=text&sol;javascript>{"key":!0}</script>'
 assert "$expected" "$input"
 
+input='<script type="importmap" data-x="&#99999999999;"> { "a" : 1 } </script><script type="text/template"> a </script>'
+expected='<script type=importmap data-x=&#99999999999;>{"a":1}</script><script type="text/template"> a </script>'
+assert "$expected" "$input"
+
+input='<PRE> a  b </PRE> <textarea> c  d </textarea> <Textarea x=1> e  f </Textarea> <b> g  h </b>'
+expected='<PRE> a  b </PRE><textarea> c  d </textarea><Textarea x=1> e  f </Textarea><b> g h </b>'
+assert "$expected" "$input"
+
 input='<html prop=/>'
 expected='<html prop=/>'
 assert "$expected" "$input"
@@ -68,4 +76,220 @@ input='<html>  <!---->'
 expected='<html> '
 assert "$expected" "$input"
 
+input='<script>a="</scrip"</script>'
+expected='<script>a="</scrip"</script>'
+assert "$expected" "$input"
+
+input='<style> a { b : c } </style><script> f ( 1 ) </script><style> d { e : f } </style>'
+expected='<style>a{b:c}</style><script>f(1)</script><style>d{e:f}</style>'
+assert "$expected" "$input"
+
+input='<p style=" color : red ; margin : 0.5em ; " title="a>b">x</p>'
+expected='<p style=color:red;margin:.5em title="a>b">x</p>'
+assert "$expected" "$input"
+
+input='<a onclick=" return  foo ( &quot;a&quot; , 1 ) ; ">x</a><a onclick="x(&nbsp;)">y</a>'
+expected="<a onclick='return foo(\"a\",1)'>x</a><a onclick=x(&nbsp;)>y</a>"
+assert "$expected" "$input"
+
+input="<a onclick=\"x(&quot;&amp;lt;&quot;, 'a')\">x</a>"
+expected="<a onclick='x(\"&amp;lt;\",&#39;a&#39;)'>x</a>"
+assert "$expected" "$input"
+
+input='<a onclick="a=é">x</a>'
+expected='<a onclick="a=é">x</a>'
+assert "$expected" "$input"
+
+# Invalid CSS or JavaScript in attributes, like template placeholders, is kept as it is
+
+input='<a onclick="f(">x</a>'
+expected='<a onclick=f(>x</a>'
+assert "$expected" "$input"
+
+input='<p style="{{x}}">x</p>'
+expected='<p style={{x}}>x</p>'
+assert "$expected" "$input"
+
+# Only real event handler attributes are minified as JavaScript
+
+input='<a one="a  b" only="a  b" onClick="f( 1 )">x</a>'
+expected='<a one="a  b" only="a  b" onClick=f(1)>x</a>'
+assert "$expected" "$input"
+
+input='<html><head> <title>x</title> </head> <body><ul><li>a</li><li>b</li></ul><p>x</p><div>y</div></body></html>'
+expected='<title>x</title><ul><li>a<li>b</ul><p>x<div>y</div>'
+assert "$expected" "$input" --omit-optional-tags
+
+input='<table> <tr> <td>1</td> <td>2</td> </tr> <tr><td>3</td></tr> </table><a><p>a</p></a><p>b</p>c<br>'
+expected='<table><tr><td>1<td>2<tr><td>3</table><a><p>a</p></a><p>b</p>c<br>'
+assert "$expected" "$input" --omit-optional-tags
+
+# The end of a paragraph in an autonomous custom element must be kept
+
+input='<my-card><p>a</p></my-card><div><p>b</p></div>'
+expected='<my-card><p>a</p></my-card><div><p>b</div>'
+assert "$expected" "$input" --omit-optional-tags
+
+# Inline blocks of large documents are minified in parallel
+
+input="$(for i in $(seq 2000); do
+	echo "<p> $i </p><script> f ( $i ) </script><style> a { b : $i } </style>"
+done)"
+expected="$(echo "$input" | ./build/cminify html - --threads 1)"
+result="$(echo "$input" | ./build/cminify html - --threads 4)"
+if [ "$expected" != "$result" ]; then
+	echo 'Error: parallel minification differs from sequential minification'
+	exit 1
+fi
+
+# Batch minification caches inline blocks shared by several documents
+
+batch_dir="$(mktemp -d)"
+mkdir "$batch_dir/in" "$batch_dir/out"
+echo '<script> f ( 1 ) </script><style> a { b : c } </style><p> x </p>' > "$batch_dir/in/a.html"
+echo '<p> y </p><script> f ( 1 ) </script><style> a { b : c } </style>' > "$batch_dir/in/b.html"
+./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/a.html" "$batch_dir/in/b.html"
+for name in a b; do
+	expected="$(./build/cminify html "$batch_dir/in/$name.html")"
+	result="$(cat "$batch_dir/out/$name.html")"
+	if [ "$expected" != "$result" ]; then
+		echo "Error: batch minification of $name.html differs:"
+		echo "$result"
+		rm -r "$batch_dir"
+		exit 1
+	fi
+done
+./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/a.html" "$batch_dir/in/b.html" \
+	--trace "$batch_dir/trace.jsonl"
+if [ "$(grep -c '"inline_js":{"count":1,' "$batch_dir/trace.jsonl")" != 2 ] ||
+	grep -q '"file":".*/a.html".*inline_cache_hit' "$batch_dir/trace.jsonl" ||
+	! grep -q '"file":".*/b.html".*"inline_cache_hit":{"count":2,' "$batch_dir/trace.jsonl"
+then
+	echo 'Error: unexpected trace:'
+	cat "$batch_dir/trace.jsonl"
+	rm -r "$batch_dir"
+	exit 1
+fi
+rm -r "$batch_dir"
+
+# Batch outputs keep their paths below the root directory, which is the current directory by default, and
+# the output directory is created if needed
+
+batch_dir="$(mktemp -d)"
+mkdir -p "$batch_dir/in/x" "$batch_dir/in/y"
+echo '<p> x </p>' > "$batch_dir/in/x/index.html"
+echo '<p> y </p>' > "$batch_dir/in/y/index.html"
+./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/x/index.html" \
+	"$batch_dir/in/y/index.html"
+if [ "$(cat "$batch_dir/out/x/index.html")" != '<p> x </p>' ] ||
+	[ "$(cat "$batch_dir/out/y/index.html")" != '<p> y </p>' ]
+then
+	echo 'Error: batch outputs of files with the same name are not kept apart'
+	rm -r "$batch_dir"
+	exit 1
+fi
+cminify="$(pwd)/build/cminify"
+(cd "$batch_dir" && "$cminify" html --batch out/cwd in/x/index.html)
+if [ "$(cat "$batch_dir/out/cwd/in/x/index.html")" != '<p> x </p>' ]; then
+	echo 'Error: batch outputs are not relative to the current directory'
+	rm -r "$batch_dir"
+	exit 1
+fi
+if ./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in/x" "$batch_dir/in/y/index.html" 2> /dev/null
+then
+	echo 'Error: batch minification accepted an input outside the root directory'
+	rm -r "$batch_dir"
+	exit 1
+fi
+if ./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/x/index.html" \
+	"$batch_dir/in/y/../x/index.html" 2> /dev/null
+then
+	echo 'Error: batch minification accepted two inputs for the same output'
+	rm -r "$batch_dir"
+	exit 1
+fi
+rm -r "$batch_dir"
+
+# Hashed asset paths are recorded in the manifest and substituted into relative references
+
+batch_dir="$(mktemp -d)"
+mkdir -p "$batch_dir/in/css" "$batch_dir/in/other" "$batch_dir/in/blog" "$batch_dir/out"
+echo 'a { b : c }' > "$batch_dir/in/css/app.css"
+echo 'd { e : f }' > "$batch_dir/in/other/app.css"
+printf '%s%s\n' '<link href="css/app.css?v=1"><link href=/css/app.css>' \
+	'<script src="https://cdn.example/css/app.css"></script><p title="css/app.css">' > "$batch_dir/in/index.html"
+echo '<link href="../css/app.css"><link href="app.css"><link href="../../css/app.css">' > "$batch_dir/in/blog/post.html"
+./build/cminify css --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/css/app.css" \
+	"$batch_dir/in/other/app.css" --hash-names --manifest "$batch_dir/out/manifest.json"
+hashed_path="$(cd "$batch_dir/out" && ls css/app.*.css)"
+other_hashed_path="$(cd "$batch_dir/out" && ls other/app.*.css)"
+hashed_name="${hashed_path#css/}"
+expected="{\"css/app.css\":\"$hashed_path\",\"other/app.css\":\"$other_hashed_path\"}"
+result="$(cat "$batch_dir/out/manifest.json")"
+if [ "$expected" != "$result" ] || [ "$(cat "$batch_dir/out/$hashed_path")" != 'a{b:c}' ]; then
+	echo 'Error: unexpected manifest:'
+	echo "$result"
+	rm -r "$batch_dir"
+	exit 1
+fi
+./build/cminify html --batch "$batch_dir/out" --root "$batch_dir/in" "$batch_dir/in/index.html" \
+	"$batch_dir/in/blog/post.html" --manifest "$batch_dir/out/manifest.json"
+for document in index.html blog/post.html; do
+	if [ "$document" = index.html ]; then
+		expected="<link href=\"css/$hashed_name?v=1\"><link href=/css/app.css>"
+		expected="$expected<script src=\"https://cdn.example/css/app.css\"></script><p title=\"css/app.css\">"
+	else
+		expected="<link href=\"../css/$hashed_name\"><link href=app.css><link href=\"../../css/app.css\">"
+	fi
+	result="$(cat "$batch_dir/out/$document")"
+	if [ "$expected" != "$result" ]; then
+		echo 'Error: expected:'
+		echo "$expected"
+		echo 'got:'
+		echo "$result"
+		rm -r "$batch_dir"
+		exit 1
+	fi
+done
+rm -r "$batch_dir"
+
+# Batches of different formats use the same manifest paths if they have the same root, even if a batch
+# contains only one file
+
+batch_dir="$(mktemp -d)"
+mkdir -p "$batch_dir/site/css"
+echo 'a { b : c }' > "$batch_dir/site/css/app.css"
+echo '<link href="css/app.css">' > "$batch_dir/site/index.html"
+(cd "$batch_dir" && "$cminify" css --batch out site/css/app.css --hash-names --manifest manifest.json &&
+	"$cminify" html --batch out site/index.html --manifest manifest.json)
+hashed_name="$(cd "$batch_dir/out/site/css" && ls app.*.css)"
+if [ "$(cat "$batch_dir/out/site/index.html")" != "<link href=\"css/$hashed_name\">" ]; then
+	echo 'Error: the reference to the stylesheet of a separate batch is not replaced:'
+	cat "$batch_dir/out/site/index.html"
+	rm -r "$batch_dir"
+	exit 1
+fi
+rm -r "$batch_dir"
+
+# Escaped surrogate pairs in the manifest are decoded to UTF-8
+
+batch_dir="$(mktemp -d)"
+printf '%s\n' '{"\ud83d\ude00.css":"\ud83d\ude00.0123456789abcdef.css"}' > "$batch_dir/manifest.json"
+echo '<link href="😀.css">' > "$batch_dir/index.html"
+./build/cminify html --batch "$batch_dir/out" --root "$batch_dir" "$batch_dir/index.html" \
+	--manifest "$batch_dir/manifest.json"
+if [ "$(cat "$batch_dir/out/index.html")" != '<link href=😀.0123456789abcdef.css>' ]; then
+	echo 'Error: unexpected manifest lookup:'
+	cat "$batch_dir/out/index.html"
+	rm -r "$batch_dir"
+	exit 1
+fi
+rm -r "$batch_dir"
+
+# Input found by the fuzzer, which read before the result
+
+input='  b : c <p>x</p>'
+expected=' b : c <p>x</p>'
+assert "$expected" "$input"
+
 echo 'Passed all tests'
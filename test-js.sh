@@ -17,11 +17,26 @@ assert()
 		exit 1
 	fi
 }
+
+assert_error()
+{
+	error="$(printf '%s' "$1" | ./build/cminify js - 2>&1 > /dev/null)"
+	if [ "$?" != "1" ] || [ "${error#*, column }" = "$error" ]; then
+		echo 'Error: expected a syntax error on:'
+		echo "$1"
+		exit 1
+	fi
+}
 input='`a\
 b`'
 expected='`ab`'
 assert "$expected" "$input"
 
+input='`a\\\n\nb`'
+expected='`a
+b`'
+assert "$expected" "$input"
+
 input='` a ${ 1 + ` 2 ` + 3 } c` + `d${a}}`'
 expected='` a ${1+` 2 `+3} cd${a}}`'
 assert "$expected" "$input"
@@ -166,4 +181,114 @@ input='function a () {}; function b () {}\n if(true) {} ; a=3'
 expected='function a(){}function b(){}if(!0);a=3'
 assert "$expected" "$input"
 
+input='function * f(){}function*g(){}'
+expected='function*f(){}function*g(){}'
+assert "$expected" "$input"
+
+# Compressed output spanning several compression chunks decompresses to the minification
+
+compression_input="$(mktemp)"
+yes 'function f ( a , b ) { return a + b * 42 ; } var x = f ( 1 , 2 ) ;' | head -n 30000 > "$compression_input"
+expected="$(./build/cminify js "$compression_input")"
+for level in 0 1 6 9; do
+	result="$(./build/cminify js "$compression_input" --gzip $level --threads 4 | gzip -dc)"
+	if [ "$expected" != "$result" ]; then
+		echo "Error: gzip level $level output differs from the minification"
+		rm "$compression_input"
+		exit 1
+	fi
+done
+
+# Bytes above 127 have 9-bit codes in the fixed Huffman code of small deflate blocks
+
+echo 'let s = "héllo wörld ünïcödé" ;' > "$compression_input"
+expected="$(./build/cminify js "$compression_input")"
+for level in 0 1 6 9; do
+	result="$(./build/cminify js "$compression_input" --gzip $level | gzip -dc)"
+	if [ "$expected" != "$result" ]; then
+		echo "Error: gzip level $level output of non-ASCII input differs from the minification"
+		rm "$compression_input"
+		exit 1
+	fi
+done
+
+# A higher level or quality never gives a larger output, also on repetitive input whose matches vary in distance
+
+for i in $(seq 20000); do
+	echo "var v$i = \"x$((i % 7))\" + q$((i % 13)) ;"
+done > "$compression_input"
+for level in 1 2 3 4 5 6 7 8 9; do
+	size="$(./build/cminify js "$compression_input" --gzip $level | wc -c)"
+	if [ $level -gt 1 ] && [ "$size" -gt "$previous_size" ]; then
+		echo "Error: gzip level $level output is larger than level $((level - 1)): $size > $previous_size bytes"
+		rm "$compression_input"
+		exit 1
+	fi
+	previous_size="$size"
+done
+for quality in 0 1 2 3 4 5 6 7 8 9 10 11; do
+	size="$(./build/cminify js "$compression_input" --brotli $quality | wc -c)"
+	if [ $quality -gt 0 ] && [ "$size" -gt "$previous_size" ]; then
+		echo "Error: brotli quality $quality output is larger than quality $((quality - 1)): $size > $previous_size bytes"
+		rm "$compression_input"
+		exit 1
+	fi
+	previous_size="$size"
+done
+
+# Brotli output is only checked if Node.js is available to decompress it
+
+yes 'function f ( a , b ) { return a + b * 42 ; } var x = f ( 1 , 2 ) ;' | head -n 30000 > "$compression_input"
+expected="$(./build/cminify js "$compression_input")"
+if command -v node > /dev/null; then
+	for quality in 0 5 11; do
+		result="$(./build/cminify js "$compression_input" --brotli $quality --threads 4 |
+			node -e 'process.stdout.write(require("zlib").brotliDecompressSync(require("fs").readFileSync(0)))')"
+		if [ "$expected" != "$result" ]; then
+			echo "Error: brotli quality $quality output differs from the minification"
+			rm "$compression_input"
+			exit 1
+		fi
+	done
+fi
+rm "$compression_input"
+
+# Benchmark statistics can be printed as JSON
+
+result="$(echo 'a = 1 ;' | ./build/cminify js - --benchmark --repeat 3 --warmup 2 --json --gzip 9)"
+prefix='{"format":"js","input_bytes":8,"output_bytes":3,"reduction_percent":62.50,"runs":3,"warmup_runs":2,'
+case "$result" in
+	"$prefix"'"min_ms":'*',"gzip_level":9,"gzip_bytes":23}') ;;
+	*)
+		echo 'Error: unexpected benchmark output:'
+		echo "$result"
+		exit 1
+		;;
+esac
+
+# The latencies of small inputs are not rounded to zero
+
+result="$(echo 'a = 1 ;' | ./build/cminify js - --benchmark --repeat 3)"
+case "$result" in
+	*' 0.000 ms'*|*' 0.0 µs'*)
+		echo 'Error: unexpected benchmark output:'
+		echo "$result"
+		exit 1
+		;;
+esac
+
+# Inputs found by the fuzzer, which read outside the input, the result or the block stack
+
+result="$(printf 'return' | ./build/cminify js -)"
+if [ "$result" != 'return' ]; then
+	echo 'Error: a word at the end of the input is not kept:'
+	echo "$result"
+	exit 1
+fi
+assert_error ')'
+
+input='"ab"'
+expected='"ab"'
+assert "$expected" "$input"
+
 echo 'Passed all tests'
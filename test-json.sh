@@ -2,7 +2,7 @@
 
 assert()
 {
-	result="$(echo -e "$2" | ./build/cminify json -)"
+	result="$(echo -e "$2" | ./build/cminify json - $3)"
 	if [ "$?" != "0" ]; then
 		echo Crashed on:
 		echo "$2"
@@ -18,8 +18,32 @@ assert()
 	fi
 }
 
+assert_error()
+{
+	error="$(printf '%s' "$1" | ./build/cminify json - 2>&1 > /dev/null)"
+	if [ "$?" != "1" ] || [ "${error#*, column }" = "$error" ]; then
+		echo 'Error: expected a syntax error on:'
+		echo "$1"
+		exit 1
+	fi
+}
+
 input=' { "false": false, "true": true } '
 expected='{"false":false,"true":true}'
 assert "$expected" "$input"
 
+input='[ -1, 1.50, 1.5E+10, -0.0, 1e+05 ]'
+expected='[-1,1.50,1.5E+10,-0.0,1e+05]'
+assert "$expected" "$input"
+
+input='[ -1, 1.50, 1.5E+10, -0.0, 1e+05, 0.001e5, -12.500e-2, 100, 1.0, 1E+2, 1500.00, 0.00, 5e0 ]'
+expected='[-1,1.5,15e9,-0.0,1e5,1e2,-0.125,100,1.0,1e2,15e2,0.0,5.0]'
+assert "$expected" "$input" --canonical-numbers
+
+# Inputs found by the fuzzer, which read before the result
+
+assert_error ']'
+assert_error '}'
+assert_error ','
+
 echo 'Passed all tests'
@@ -14,6 +14,24 @@ assert()
 		echo "$result"
 		exit 1
 	fi
+	result="$(echo -e "$2" | ./build/cminify xml --stream -)"
+	if [ "$1" != "$result" ]; then
+		echo 'Error: expected with --stream:'
+		echo "$1"
+		echo 'got:'
+		echo "$result"
+		exit 1
+	fi
+}
+
+assert_error()
+{
+	error="$(printf '%s' "$1" | ./build/cminify xml - 2>&1 > /dev/null)"
+	if [ "$?" != "1" ] || [ "${error#*, column }" = "$error" ]; then
+		echo 'Error: expected a syntax error on:'
+		echo "$1"
+		exit 1
+	fi
 }
 
 input='<?xml version="1.0" encoding="iso-8859-1"?>'
@@ -52,4 +70,29 @@ input=' <xml a = " b " > <b>  </b><a /><a b="c"/> </xml>'
 expected=' <xml a=" b "><b>  </b><a/><a b="c"/></xml>'
 assert "$expected" "$input"
 
+input='<script>a = "]]" + "&gt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;&lt;"</script>'
+expected='<script><![CDATA[a="]]]]><![CDATA[><<<<<<<<"]]></script>'
+assert "$expected" "$input"
+
+input='<style>a&gt;b { c : d }</style>'
+expected='<style>a&gt;b{c:d}</style>'
+assert "$expected" "$input"
+
+input='<svg><script href="a.js"/><a>  </a></svg>'
+expected='<svg><script href="a.js"/><a>  </a></svg>'
+assert "$expected" "$input"
+
+# Documents larger than the streaming chunk size are minified in several segments
+
+input="<svg>$(for i in $(seq 3000); do
+	echo -n "<a b=\"> $i\"> x $i <!-- c --> </a> <style> a { b : c } </style> <![CDATA[ $i ]]> text-$i"
+done)</svg>"
+expected="$(echo -n "$input" | ./build/cminify xml -)"
+assert "$expected" "$input"
+
+# Inputs found by the fuzzer, which read past the input
+
+assert_error '<a><![CDATA[x'
+assert_error '<a></a'
+
 echo 'Passed all tests'